@@ -3,48 +3,142 @@
 #include <llvm/IR/Value.h>
 #include "ast.h"
 
+thread_local SymbolInterner *SymbolInterner::current = nullptr;
+
+SymbolId SymbolInterner::intern(const char *name, size_t length)
+{
+    auto it = ids.find(std::string_view(name, length));
+    if (it != ids.end())
+    {
+        return it->second;
+    }
+    SymbolId id = names.size();
+    names.emplace_back(name, length);
+    ids.emplace(names.back(), id);
+    return id;
+}
+
+static size_t slotIndex(SymbolId id, size_t mask)
+{
+    // fibonacci hashing, consecutive ids end up far apart
+    return ((size_t)id * 0x9E3779B97F4A7C15ull >> 32) & mask;
+}
+
+template <typename T>
+typename SymbolTable<T>::Slot &SymbolTable<T>::findSlot(SymbolId id)
+{
+    if (2 * (usedSlots + 1) > slots.size())
+    {
+        // keep the load factor below 1/2
+        std::vector<Slot> old(slots.size() ? 2 * slots.size() : 64);
+        old.swap(slots);
+        for (auto &slot : old)
+        {
+            if (slot.id != -1)
+            {
+                size_t i = slotIndex(slot.id, slots.size() - 1);
+                while (slots[i].id != -1)
+                {
+                    i = (i + 1) & (slots.size() - 1);
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+
+    size_t i = slotIndex(id, slots.size() - 1);
+    while (slots[i].id != id && slots[i].id != -1)
+    {
+        i = (i + 1) & (slots.size() - 1);
+    }
+    if (slots[i].id == -1)
+    {
+        slots[i].id = id;
+        usedSlots++;
+    }
+    return slots[i];
+}
+
+template <typename T>
+int SymbolTable<T>::innermost(SymbolId id)
+{
+    if (slots.empty())
+    {
+        return -1;
+    }
+    size_t i = slotIndex(id, slots.size() - 1);
+    while (slots[i].id != id)
+    {
+        if (slots[i].id == -1)
+        {
+            return -1;
+        }
+        i = (i + 1) & (slots.size() - 1);
+    }
+    return slots[i].innermost;
+}
+
 template <typename T>
 void SymbolTable<T>::createNewEnv()
 {
-    this->table.push_back(std::unordered_map<std::string, T>());
+    this->scopeStarts.push_back(this->bindings.size());
 }
 
 template <typename T>
 void SymbolTable<T>::popEnv()
 {
-    this->table.pop_back();
+    size_t start = this->scopeStarts.back();
+    this->scopeStarts.pop_back();
+    while (this->bindings.size() > start)
+    {
+        auto &binding = this->bindings.back();
+        findSlot(binding.id).innermost = binding.shadowed;
+        this->bindings.pop_back();
+    }
 }
 
 template <typename T>
-bool SymbolTable<T>::addToEnv(std::string id, T val)
+bool SymbolTable<T>::addToEnv(SymbolId id, T val)
 {
-    if (this->table.back().count(id) > 0)
+    auto &slot = findSlot(id);
+    if (slot.innermost >= (int)this->scopeStarts.back())
     {
         return false;
     }
-    this->table.back()[id] = val;
+    this->bindings.push_back({id, val, slot.innermost});
+    slot.innermost = this->bindings.size() - 1;
     return true;
 }
 
 template <typename T>
-bool SymbolTable<T>::checkEnv(std::string id)
+bool SymbolTable<T>::checkEnv(SymbolId id)
 {
-    return this->table.back().count(id) > 0;
+    return innermost(id) >= (int)this->scopeStarts.back();
 }
 
 template <typename T>
-T SymbolTable<T>::getFromEnv(std::string id)
+T SymbolTable<T>::getFromEnv(SymbolId id)
 {
-    for (auto it = this->table.rbegin(); it != this->table.rend(); it++)
+    int binding = innermost(id);
+    if (binding == -1)
     {
-        if (it->count(id) != 0)
-        {
-            return (*it)[id];
-        }
+        return nullptr;
+    }
+    return this->bindings[binding].val;
+}
+
+template <typename T>
+std::vector<std::pair<SymbolId, T>> SymbolTable<T>::globals() const
+{
+    std::vector<std::pair<SymbolId, T>> result;
+    size_t end = this->scopeStarts.size() > 1 ? this->scopeStarts[1] : this->bindings.size();
+    for (size_t i = 0; i < end; i++)
+    {
+        result.push_back(std::make_pair(this->bindings[i].id, this->bindings[i].val));
     }
-    return nullptr;
+    return result;
 }
 
 template class SymbolTable<ast::yyAST *>;
 template class SymbolTable<llvm::Value *>;
-template class SymbolTable<llvm::Function *>;
\ No newline at end of file
+template class SymbolTable<llvm::Function *>;
@@ -1,22 +1,87 @@
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 
 #ifndef LAB2_SYMBOLTABLE_H
 #define LAB2_SYMBOLTABLE_H
 
+// identifiers (and string literals) are interned once, in the lexer, into small
+// dense integer ids. The pool keeps one copy of every distinct spelling for the
+// whole compilation, the ast refers to it by id or string_view.
+typedef int SymbolId;
+
+class SymbolInterner
+{
+public:
+    SymbolId intern(const char *name, size_t length);
+    SymbolId intern(const std::string &name)
+    {
+        return intern(name.data(), name.size());
+    }
+    const std::string &name(SymbolId id) const
+    {
+        return names[id];
+    }
+    size_t size() const
+    {
+        return names.size();
+    }
+
+    // interner of the compilation running on this thread (used by the lexer)
+    static thread_local SymbolInterner *current;
+
+private:
+    // deque: the strings never move, so the views in `ids` stay valid
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, SymbolId> ids;
+};
+
+// Scoped symbol table. All scopes share one open addressing hash map from symbol id
+// to the innermost binding of the symbol; the bindings themselves live on a stack,
+// each one remembering the binding of the same symbol it shadows. Entering a scope
+// only records the stack height, leaving it unwinds the bindings made in it.
 template <typename T>
 class SymbolTable
 {
 public:
     void createNewEnv();
-    bool addToEnv(std::string id, T val);
-    T getFromEnv(std::string id);
+    bool addToEnv(SymbolId id, T val);
+    T getFromEnv(SymbolId id);
     void popEnv();
-    bool checkEnv(std::string id);
+    bool checkEnv(SymbolId id);
+
+    // number of open scopes, 1 means only the global scope is open
+    size_t depth() const
+    {
+        return scopeStarts.size();
+    }
+    // (symbol, value) of the bindings of the outermost scope, in declaration order
+    std::vector<std::pair<SymbolId, T>> globals() const;
+
+private:
+    struct Binding
+    {
+        SymbolId id;
+        T val;
+        int shadowed; // index of the outer binding of the same symbol, -1 if none
+    };
+    std::vector<Binding> bindings;
+    std::vector<size_t> scopeStarts;
+
+    // open addressing with linear probing, keys are never removed: a symbol whose
+    // last binding went out of scope keeps its slot with innermost == -1
+    struct Slot
+    {
+        SymbolId id = -1;
+        int innermost = -1;
+    };
+    std::vector<Slot> slots;
+    size_t usedSlots = 0;
 
-public: // for debugging now
-    std::vector<std::unordered_map<std::string, T>> table;
+    Slot &findSlot(SymbolId id);
+    int innermost(SymbolId id);
 };
 
 #endif // LAB2_SYMBOLTABLE_H
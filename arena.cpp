@@ -0,0 +1,105 @@
+#include "arena.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <sys/resource.h>
+
+thread_local Arena *Arena::current = nullptr;
+
+Arena::~Arena()
+{
+    for (auto chunk : chunks)
+    {
+        free(chunk);
+    }
+}
+
+static char *alignUp(char *ptr, size_t align)
+{
+    return (char *)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+char *Arena::newChunk(size_t size)
+{
+    auto chunk = (char *)malloc(size);
+    if (chunk == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    chunks.push_back(chunk);
+    reserved += size;
+    return chunk;
+}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+    allocations++;
+    bytesAllocated += size;
+
+    if (size + align > chunkSize / 4)
+    {
+        // big objects get a chunk of their own, the current one stays in use
+        return alignUp(newChunk(size + align), align);
+    }
+
+    auto aligned = alignUp(ptr, align);
+    if (ptr == nullptr || aligned + size > end)
+    {
+        ptr = newChunk(chunkSize);
+        end = ptr + chunkSize;
+        aligned = alignUp(ptr, align);
+    }
+    ptr = aligned + size;
+    return aligned;
+}
+
+void *ArenaAllocated::operator new(size_t size)
+{
+    if (Arena::current == nullptr)
+    {
+        return ::operator new(size);
+    }
+    return Arena::current->allocate(size);
+}
+
+long peakRSSKilobytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool countingAllocations = false;
+static std::atomic<long> allocationCounter(0);
+
+void enableAllocationCounting()
+{
+    countingAllocations = true;
+}
+
+long allocationCount()
+{
+    return allocationCounter.load(std::memory_order_relaxed);
+}
+
+// replaces the global operator new of the program to count the allocations, the default
+// operator delete frees with free() so it still matches
+void *operator new(size_t size)
+{
+    if (countingAllocations)
+    {
+        allocationCounter.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
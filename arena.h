@@ -0,0 +1,54 @@
+#include <cstddef>
+#include <vector>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+// Bump-pointer allocator for objects that live as long as the compilation (ast nodes,
+// types). Memory is taken from the system in large chunks and only given back, all at
+// once, when the arena is destroyed. Destructors of the objects are never run.
+class Arena
+{
+public:
+    explicit Arena(size_t chunkSize = 1 << 20) : chunkSize(chunkSize) {}
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    // arena used by ArenaAllocated::operator new on this thread, nullptr means plain new
+    static thread_local Arena *current;
+
+    // statistics for -mem-report
+    size_t allocations = 0;
+    size_t bytesAllocated = 0;
+    size_t chunkCount() const { return chunks.size(); }
+    size_t bytesReserved() const { return reserved; }
+
+private:
+    char *newChunk(size_t size);
+
+    size_t chunkSize;
+    std::vector<char *> chunks;
+    char *ptr = nullptr;
+    char *end = nullptr;
+    size_t reserved = 0;
+};
+
+// makes `new T(...)` of a subclass allocate in Arena::current, delete is a no-op
+struct ArenaAllocated
+{
+    static void *operator new(size_t size);
+    static void operator delete(void *) {}
+};
+
+// peak resident set size of the process in KB
+long peakRSSKilobytes();
+
+// number of heap allocations (global operator new, as used by the standard containers and
+// llvm) the process has made since enableAllocationCounting(), 0 before that
+void enableAllocationCounting();
+long allocationCount();
+
+#endif // ARENA_H
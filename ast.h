@@ -2,8 +2,14 @@
 #include <iostream>
 #include <unordered_map>
 #include <set>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include "SymbolTable.h"
+#include "arena.h"
+#include "code_emission.h"
+#include "work_queue.h"
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/BasicBlock.h>
@@ -15,6 +21,7 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 
@@ -25,28 +32,40 @@
 
 // TODO: double not supported yet
 
-extern int yylineno;
+// line the scanner of this thread is at, set by the lexer before every token
+// (thread local, so several files can be parsed at the same time)
+inline thread_local int parseLineNo = 1;
 
 using namespace llvm;
 
 namespace ast
 {
 
+    class Type;
+
     struct CodeGenContext
     {
         std::unique_ptr<LLVMContext> context;
         std::unique_ptr<Module> module;
         std::unique_ptr<IRBuilder<>> builder;
-        std::unordered_map<std::string, Value *> *stringLiterals;
+        std::unordered_map<SymbolId, Value *> *stringLiterals;
         SymbolTable<llvm::Value *> *varTable;
         SymbolTable<llvm::Function *> *funcTable;
+        // llvm type of every (interned) ast type lowered so far, see Type::llvmType
+        std::unordered_map<Type *, llvm::Type *> loweredTypes;
+        long typeCacheHits = 0;
+        long typeCacheMisses = 0;
+        // function bodies are lowered on this many threads (-codegen-threads), see yyTU::codeGen
+        unsigned threads = 1;
+        // held while printing the module on a fatal error, so output of threads doesn't mix
+        static inline std::mutex printLock;
 
         CodeGenContext()
         {
             context = std::make_unique<LLVMContext>();
             module = std::make_unique<Module>("col728", *context);
             builder = std::make_unique<IRBuilder<>>(*context);
-            stringLiterals = new std::unordered_map<std::string, Value *>();
+            stringLiterals = new std::unordered_map<SymbolId, Value *>();
             varTable = new SymbolTable<llvm::Value *>();
             funcTable = new SymbolTable<llvm::Function *>();
         }
@@ -62,18 +81,54 @@ namespace ast
         TYPE_ELLIPSIS
     };
 
-    class Type
+    class Type;
+    class SimpleType;
+    class PointerType;
+    class FunctionType;
+
+    // Uniques the pointer and function types of a compilation, the same way LLVMContext
+    // uniques llvm types: there is exactly one object per distinct type, so types are
+    // compared by pointer. The simple types are process wide singletons.
+    class TypeContext
+    {
+    public:
+        // context used by PointerType::get / FunctionType::get on this thread
+        static inline thread_local TypeContext *current = nullptr;
+
+        std::map<std::pair<int, yySimpleType>, PointerType *> pointerTypes;
+        std::map<std::pair<Type *, std::vector<Type *>>, FunctionType *> functionTypes;
+    };
+
+    // types and ast nodes are placed in the arena of the compilation
+    // types are never created directly, use the static get() of the subclasses
+    class Type : public ArenaAllocated
     {
     public:
         virtual std::string typeStr()
         {
             return "no-type";
         }
-        virtual bool equals(Type *other)
+        // types are interned
+        bool equals(Type *other)
         {
-            return this->typeStr() == other->typeStr();
+            return this == other;
         }
-        virtual llvm::Type *llvmType(CodeGenContext *context)
+        // the llvm type of this type, each type is lowered only once per module
+        llvm::Type *llvmType(CodeGenContext *context)
+        {
+            auto &lowered = context->loweredTypes[this];
+            if (lowered != nullptr)
+            {
+                context->typeCacheHits++;
+                return lowered;
+            }
+            context->typeCacheMisses++;
+            lowered = lower(context);
+            return lowered;
+        }
+
+    protected:
+        virtual llvm::Type *lower(CodeGenContext *context)
         {
             return nullptr;
         }
@@ -81,11 +136,16 @@ namespace ast
 
     class SimpleType : public Type
     {
+        SimpleType(yySimpleType simpleType) : simpleType(simpleType){};
 
     public:
         yySimpleType simpleType;
 
-        SimpleType(yySimpleType simpleType) : simpleType(simpleType){};
+        static SimpleType *get(yySimpleType simpleType)
+        {
+            static SimpleType types[] = {TYPE_INT, TYPE_VOID, TYPE_FLOAT, TYPE_CHAR, TYPE_BOOL, TYPE_ELLIPSIS};
+            return &types[simpleType];
+        }
 
         std::string typeStr()
         {
@@ -106,7 +166,9 @@ namespace ast
             }
             return "error";
         }
-        llvm::Type *llvmType(CodeGenContext *context)
+
+    protected:
+        llvm::Type *lower(CodeGenContext *context)
         {
             switch (simpleType)
             {
@@ -130,20 +192,40 @@ namespace ast
     class PointerType : public Type
     {
         int pointer_cnt = 0;
-        SimpleType simpleType;
+        SimpleType *simpleType;
+        // the type pointed to, interned together with this one so that removePointer() never
+        // touches the type context: codegen threads (-codegen-threads) lower types without one
+        Type *pointee;
+
+        PointerType(int pointer_cnt, SimpleType *simpleType, Type *pointee)
+            : pointer_cnt(pointer_cnt), simpleType(simpleType), pointee(pointee){};
 
     public:
-        PointerType(int pointer_cnt, SimpleType simpleType) : pointer_cnt(pointer_cnt), simpleType(simpleType){};
+        // `pointer_cnt` levels of pointers to `simpleType`, pointer_cnt > 0
+        static PointerType *get(int pointer_cnt, yySimpleType simpleType)
+        {
+            assert(pointer_cnt > 0 && TypeContext::current != nullptr);
+            auto &type = TypeContext::current->pointerTypes[std::make_pair(pointer_cnt, simpleType)];
+            if (type == nullptr)
+            {
+                Type *pointee = SimpleType::get(simpleType);
+                if (pointer_cnt > 1)
+                {
+                    pointee = get(pointer_cnt - 1, simpleType);
+                }
+                // `type` stays valid, std::map references survive the insert of the recursive get()
+                type = new PointerType(pointer_cnt, SimpleType::get(simpleType), pointee);
+            }
+            return type;
+        }
 
-        PointerType addPointer()
+        Type *addPointer()
         {
-            PointerType newType(this->pointer_cnt + 1, this->simpleType);
-            return newType;
+            return get(this->pointer_cnt + 1, this->simpleType->simpleType);
         }
-        PointerType removePointer()
+        Type *removePointer()
         {
-            PointerType newType(this->pointer_cnt - 1, this->simpleType);
-            return newType;
+            return pointee;
         }
 
         std::string typeStr()
@@ -153,26 +235,35 @@ namespace ast
             {
                 typeStr += "*";
             }
-            typeStr += simpleType.typeStr();
+            typeStr += simpleType->typeStr();
             return typeStr;
         }
-        llvm::Type *llvmType(CodeGenContext *context)
+
+    protected:
+        llvm::Type *lower(CodeGenContext *context)
         {
-            llvm::Type *type = simpleType.llvmType(context);
-            for (int i = 0; i < pointer_cnt; i++)
-            {
-                type = type->getPointerTo();
-            }
-            return type;
+            return removePointer()->llvmType(context)->getPointerTo();
         }
     };
 
     class FunctionType : public Type
     {
+        FunctionType(std::vector<Type *> paramTypes, Type *returnType) : paramTypes(paramTypes), returnType(returnType){};
+
     public:
         std::vector<Type *> paramTypes;
         Type *returnType;
-        FunctionType(std::vector<Type *> paramTypes, Type *returnType) : paramTypes(paramTypes), returnType(returnType){};
+
+        static FunctionType *get(const std::vector<Type *> &paramTypes, Type *returnType)
+        {
+            assert(TypeContext::current != nullptr);
+            auto &type = TypeContext::current->functionTypes[std::make_pair(returnType, paramTypes)];
+            if (type == nullptr)
+            {
+                type = new FunctionType(paramTypes, returnType);
+            }
+            return type;
+        }
 
         std::string typeStr()
         {
@@ -192,12 +283,18 @@ namespace ast
         }
 
         llvm::FunctionType *llvmFuncType(CodeGenContext *context)
+        {
+            return cast<llvm::FunctionType>(llvmType(context));
+        }
+
+    protected:
+        llvm::Type *lower(CodeGenContext *context)
         {
             std::vector<llvm::Type *> paramTypesLLVM;
             bool containsEllipsis = false;
             for (auto type : paramTypes)
             {
-                if (type->typeStr() == "...")
+                if (type == SimpleType::get(TYPE_ELLIPSIS))
                 {
                     containsEllipsis = true;
                 }
@@ -210,26 +307,21 @@ namespace ast
             }
             return llvm::FunctionType::get(returnType->llvmType(context), paramTypesLLVM, containsEllipsis);
         }
-
-        llvm::Type *llvmType(CodeGenContext *context)
-        {
-            return llvmFuncType(context);
-        }
     };
 
     // template <typename T>
-    class yyAST
+    class yyAST : public ArenaAllocated
     {
     public:
         int line_no;
 
         bool dont_drop_env = false;
 
-        Type *my_type = new SimpleType(TYPE_VOID);
+        Type *my_type = SimpleType::get(TYPE_VOID);
 
         LLVMValueRef llvm_value = nullptr;
 
-        yyAST() : line_no(yylineno){};
+        yyAST() : line_no(parseLineNo){};
 
         void eval();
 
@@ -247,6 +339,16 @@ namespace ast
             nodes.push_back(node);
         }
 
+        // number of nodes of every kind in this subtree (-ftime-report)
+        void countNodes(std::map<std::string, long> &counts)
+        {
+            counts[name()]++;
+            for (auto node : nodes)
+            {
+                node->countNodes(counts);
+            }
+        }
+
         virtual void print(int indent = 0)
         {
             std::cout << std::string(2 * indent, ' ') << name() << "---\n";
@@ -274,10 +376,18 @@ namespace ast
             {
                 result &= node->typeCheck(symTable);
             }
-            my_type = new SimpleType(TYPE_VOID);
+            my_type = SimpleType::get(TYPE_VOID);
             return result;
         }
 
+        // creates the llvm globals / functions of a top level declaration, before any
+        // function body is generated (bodies only refer to what was declared here).
+        // Returns true if codeGen still has a function body to generate for the node.
+        virtual bool declare(CodeGenContext *cgenContext)
+        {
+            return false;
+        }
+
         virtual Value *codeGen(CodeGenContext *cgenContext)
         {
             for (auto node : nodes)
@@ -301,6 +411,12 @@ namespace ast
             nodes.push_back(decl);
         }
 
+        // string literals of the unit, they are declared together with the globals
+        void addStringLiteral(yyAST *literal)
+        {
+            stringLiterals.push_back(literal);
+        }
+
         bool envCheck(SymbolTable<yyAST *> *symTable)
         {
             bool result = true;
@@ -320,23 +436,91 @@ namespace ast
             {
                 result &= node->typeCheck(symTable);
             }
-            my_type = new SimpleType(TYPE_VOID);
+            my_type = SimpleType::get(TYPE_VOID);
             return result;
         }
         Value *codeGen(CodeGenContext *cgenContext)
         {
-            auto varTable = cgenContext->varTable;
-            auto funcTable = cgenContext->funcTable;
+            // first every global and function, then the bodies
+            auto definitions = declareAll(cgenContext);
+            unsigned threads = std::min<size_t>(cgenContext->threads, definitions.size());
+            if (threads <= 1)
+            {
+                for (auto definition : definitions)
+                {
+                    definition->codeGen(cgenContext);
+                }
+                return nullptr;
+            }
 
-            varTable->createNewEnv();
-            funcTable->createNewEnv();
+            // An LLVMContext can only be used by one thread, so every thread generates its
+            // functions into its own context and module, with all declarations repeated in
+            // the same order. The ast is only read. The modules come back as bitcode and
+            // their bodies are moved into the functions of cgenContext's module.
+            WorkStealingQueues queues(definitions.size(), threads);
+            std::vector<SmallVector<char, 0>> parts(threads);
+            std::vector<long> hits(threads), misses(threads);
+            auto work = [&](unsigned thread)
+            {
+                CodeGenContext part;
+                declareAll(&part);
+                size_t item;
+                while (queues.pop(thread, item))
+                {
+                    definitions[item]->codeGen(&part);
+                }
+                raw_svector_ostream out(parts[thread]);
+                WriteBitcodeToFile(*part.module, out);
+                hits[thread] = part.typeCacheHits;
+                misses[thread] = part.typeCacheMisses;
+            };
+            std::vector<std::thread> workers;
+            for (unsigned thread = 0; thread < threads; thread++)
+            {
+                workers.emplace_back(work, thread);
+            }
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
 
-            for (auto node : nodes)
+            for (unsigned thread = 0; thread < threads; thread++)
             {
-                node->codeGen(cgenContext);
+                std::string error;
+                if (!moveFunctionBodies(cgenContext->module.get(), StringRef(parts[thread].data(), parts[thread].size()), error))
+                {
+                    std::cerr << "Fatal Error: " << error << std::endl;
+                    std::cerr << "Compilation Failed... Aborting.." << std::endl;
+                    exit(1);
+                }
+                cgenContext->typeCacheHits += hits[thread];
+                cgenContext->typeCacheMisses += misses[thread];
             }
             return nullptr;
         }
+
+    private:
+        // declares the top level of the unit in cgenContext, returns the function definitions
+        std::vector<yyAST *> declareAll(CodeGenContext *cgenContext)
+        {
+            cgenContext->varTable->createNewEnv();
+            cgenContext->funcTable->createNewEnv();
+            std::vector<yyAST *> definitions;
+            for (auto node : nodes)
+            {
+                if (node->declare(cgenContext))
+                {
+                    definitions.push_back(node);
+                }
+            }
+            for (auto literal : stringLiterals)
+            {
+                literal->declare(cgenContext);
+            }
+            return definitions;
+        }
+
+        std::vector<yyAST *> stringLiterals;
     };
 
     class yyTypeSpecifier : public yyAST
@@ -418,6 +602,43 @@ namespace ast
         // Base implementation of codeGen will work.
     };
 
+    enum FunctionSpecifier
+    {
+        INLINE
+    };
+
+    class yyFunctionSpecifier : public yyAST
+    {
+    public:
+        std::string name()
+        {
+            return "yyFunctionSpecifier";
+        }
+
+        FunctionSpecifier functionSpecifier;
+
+        std::string functionSpecifierName()
+        {
+            switch (functionSpecifier)
+            {
+            case INLINE:
+                return "inline";
+            default:
+                return "error";
+            }
+        }
+
+        yyFunctionSpecifier(FunctionSpecifier functionSpecifier) : functionSpecifier(functionSpecifier){};
+
+        void print(int indent = 0)
+        {
+            std::cout << std::string(2 * indent, ' ') << "FunctionSpecifier: " << functionSpecifierName() << "\n";
+        }
+        // Base implementation of envCheck will work.
+        // Base implementation of typeCheck will work.
+        // Base implementation of codeGen will work.
+    };
+
     class yyDeclSpecifiers : public yyAST
     {
     public:
@@ -446,6 +667,19 @@ namespace ast
 
             return nullptr;
         }
+        // `inline`, the optimizer's inliner always inlines calls to these functions
+        bool isInline()
+        {
+            for (auto node : nodes)
+            {
+                yyFunctionSpecifier *spec = dynamic_cast<yyFunctionSpecifier *>(node);
+                if (spec != nullptr && spec->functionSpecifier == FunctionSpecifier::INLINE)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
         // Base implementation of envCheck will work.
         // Base Implementation of typeCheck will work.
         // Base Implementation of codeGen will work.
@@ -459,12 +693,11 @@ namespace ast
             return "yyIdentifier";
         }
 
-        std::string id;
+        // points into the string pool of the compilation, no copy per node
+        std::string_view id;
+        SymbolId sym;
 
-        yyIdentifier(char *idTok)
-        {
-            this->id = std::string(idTok);
-        }
+        yyIdentifier(SymbolId sym) : id(SymbolInterner::current->name(sym)), sym(sym) {}
 
         void print(int indent = 0)
         {
@@ -473,7 +706,7 @@ namespace ast
 
         bool envCheck(SymbolTable<yyAST *> *symTable)
         {
-            bool ret = symTable->getFromEnv(id) != nullptr;
+            bool ret = symTable->getFromEnv(sym) != nullptr;
             if (!ret)
             {
                 std::cout << "[Line No " << line_no << "] Error: " << id << " not declared in this scope\n";
@@ -483,7 +716,7 @@ namespace ast
 
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
-            yyAST *decl = symTable->getFromEnv(id);
+            yyAST *decl = symTable->getFromEnv(sym);
             assert(decl != nullptr);
             my_type = decl->my_type;
             return true;
@@ -493,7 +726,7 @@ namespace ast
         // the optimization stages will fix this.
         Value *codeGen(CodeGenContext *cgenContext)
         {
-            auto stack_loc = cgenContext->varTable->getFromEnv(id);
+            auto stack_loc = cgenContext->varTable->getFromEnv(sym);
             assert(stack_loc != nullptr); // errors should have been detected by semantic analysis.
             assert(my_type != nullptr);
             auto llvm_type = my_type->llvmType(cgenContext);
@@ -526,7 +759,7 @@ namespace ast
         }
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
-            my_type = new SimpleType(TYPE_INT);
+            my_type = SimpleType::get(TYPE_INT);
             return true;
         }
         Value *codeGen(CodeGenContext *cgenContext)
@@ -560,7 +793,7 @@ namespace ast
         }
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
-            my_type = new SimpleType(TYPE_FLOAT);
+            my_type = SimpleType::get(TYPE_FLOAT);
             return true;
         }
         Value *codeGen(CodeGenContext *cgenContext)
@@ -577,11 +810,10 @@ namespace ast
             return "yyStringLiteral";
         }
 
-        std::string v;
-        yyStringLiteral(char *val)
-        {
-            this->v = std::string(val);
-        }
+        // spelling of the literal (in the string pool), sym is its handle
+        std::string_view v;
+        SymbolId sym;
+        yyStringLiteral(SymbolId sym) : v(SymbolInterner::current->name(sym)), sym(sym) {}
 
         void print(int indent = 0)
         {
@@ -593,19 +825,30 @@ namespace ast
         }
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
-            my_type = new PointerType(1, SimpleType(TYPE_CHAR));
+            my_type = PointerType::get(1, TYPE_CHAR);
             return true;
         }
-        Value *codeGen(CodeGenContext *cgenContext)
+        // the global is created up front, with the other globals, so every thread
+        // generating functions of the unit has the same globals in the same order
+        bool declare(CodeGenContext *cgenContext)
         {
             auto stringLiterals = cgenContext->stringLiterals;
             auto builder = cgenContext->builder.get();
             auto module = cgenContext->module.get();
-            if (stringLiterals->count(v) == 0)
+            // equal literals have the same handle, so each one is emitted once
+            auto &literal = stringLiterals->operator[](sym);
+            if (literal == nullptr)
             {
-                stringLiterals->operator[](v) = builder->CreateGlobalStringPtr(v, "string_literal", 0, module);
+                literal = builder->CreateGlobalStringPtr(v, "string_literal", 0, module);
             }
-            return stringLiterals->operator[](v);
+            return false;
+        }
+
+        Value *codeGen(CodeGenContext *cgenContext)
+        {
+            auto literal = cgenContext->stringLiterals->find(sym);
+            assert(literal != cgenContext->stringLiterals->end());
+            return literal->second;
         }
     };
 
@@ -653,14 +896,12 @@ namespace ast
             assert(nodes.size() > 0);
             yyIdentifier *idNode = dynamic_cast<yyIdentifier *>(nodes[0]);
             assert(idNode != nullptr);
-            std::string id = idNode->id;
-
-            // std::cout << id << " " << line_no << " " << symTable->table.size() << "\n";
+            std::string_view id = idNode->id;
 
-            if (!symTable->addToEnv(id, this))
+            if (!symTable->addToEnv(idNode->sym, this))
             {
                 std::cerr << "[Line No " << this->line_no << "] Error: '" << id << "' already declared in this scope "
-                          << "previous declaration was at line no: " << symTable->getFromEnv(id)->line_no << std::endl;
+                          << "previous declaration was at line no: " << symTable->getFromEnv(idNode->sym)->line_no << std::endl;
                 ret = false;
             }
 
@@ -808,7 +1049,8 @@ namespace ast
             return "yyDeclaration";
         }
 
-        std::string declID;
+        std::string_view declID;
+        SymbolId declSym;
         Type *declType;
         bool isFunctionDecl = false;
 
@@ -831,14 +1073,14 @@ namespace ast
             yyTypeSpecifier *typeSpec = declSpecs->getType();
             assert(typeSpec != nullptr);
 
-            Type *type = new SimpleType(typeSpec->type);
+            Type *type = SimpleType::get(typeSpec->type);
 
             yyDeclarator *decl = dynamic_cast<yyDeclarator *>(nodes[1]);
             assert(decl != nullptr);
 
             if (decl->pointers.size() > 0)
             {
-                type = new PointerType(decl->pointers.size(), SimpleType(typeSpec->type));
+                type = PointerType::get(decl->pointers.size(), typeSpec->type);
             }
 
             yyDirectDeclarator *directDecl = dynamic_cast<yyDirectDeclarator *>(decl->directDeclarator);
@@ -846,7 +1088,7 @@ namespace ast
             assert(directDecl->nodes.size() > 0 && directDecl->nodes.size() <= 2);
             yyIdentifier *idNode = dynamic_cast<yyIdentifier *>(directDecl->nodes[0]);
             assert(idNode != nullptr);
-            std::string id = idNode->id;
+            std::string_view id = idNode->id;
 
             if (directDecl->nodes.size() == 1)
             {
@@ -858,7 +1100,7 @@ namespace ast
             {
                 isFunctionDecl = true;
                 // function declarator
-                if (symTable->table.size() != 1)
+                if (symTable->depth() != 1)
                 {
                     std::cerr << "[Line No " << this->line_no << "] Error: Function declaration must be global" << std::endl;
                 }
@@ -874,7 +1116,7 @@ namespace ast
 
                     if (ellipsis != nullptr)
                     {
-                        paramTypes.push_back(new SimpleType(TYPE_ELLIPSIS));
+                        paramTypes.push_back(SimpleType::get(TYPE_ELLIPSIS));
                     }
                     else
                     {
@@ -883,24 +1125,25 @@ namespace ast
                         assert(paramDeclSpecs != nullptr);
                         yyTypeSpecifier *paramTypeSpec = paramDeclSpecs->getType();
                         assert(paramTypeSpec != nullptr);
-                        Type *paramType = new SimpleType(paramTypeSpec->type);
+                        Type *paramType = SimpleType::get(paramTypeSpec->type);
                         yyDeclarator *paramDeclr = dynamic_cast<yyDeclarator *>(paramDecl->nodes[1]);
                         assert(paramDeclr != nullptr);
                         if (paramDeclr->pointers.size() > 0)
                         {
-                            paramType = new PointerType(paramDeclr->pointers.size(), SimpleType(paramTypeSpec->type));
+                            paramType = PointerType::get(paramDeclr->pointers.size(), paramTypeSpec->type);
                         }
                         paramTypes.push_back(paramType);
                     }
                 }
 
-                idNode->my_type = new FunctionType(paramTypes, type);
+                idNode->my_type = FunctionType::get(paramTypes, type);
             }
 
             declID = idNode->id;
+            declSym = idNode->sym;
             declType = idNode->my_type;
 
-            if (symTable->addToEnv(id, idNode))
+            if (symTable->addToEnv(declSym, idNode))
             {
                 return true;
             }
@@ -908,43 +1151,47 @@ namespace ast
             {
                 // This should not happen though, as this is checked in envCheck.
                 std::cerr << "[Line No " << this->line_no << "] Error: '" << id << "' already declared in this scope "
-                          << "previous declaration was at line no: " << symTable->getFromEnv(id)->line_no << std::endl;
+                          << "previous declaration was at line no: " << symTable->getFromEnv(declSym)->line_no << std::endl;
                 return false;
             }
         }
 
-        Value *codeGen(CodeGenContext *cgenContext)
+        bool declare(CodeGenContext *cgenContext)
         {
             auto varTable = cgenContext->varTable;
             auto functionTable = cgenContext->funcTable;
             assert(declType != nullptr);
+            assert(varTable->depth() == 1);      // should be at TU level
+            assert(functionTable->depth() == 1); // just for safety
             if (isFunctionDecl)
             {
-                assert(varTable->table.size() == 1);      // should be at TU level
-                assert(functionTable->table.size() == 1); // just for safety
                 FunctionType *funcType = dynamic_cast<FunctionType *>(declType);
                 assert(funcType != nullptr);
                 auto llvmFuncType = funcType->llvmFuncType(cgenContext);
                 Function *func = Function::Create(llvmFuncType, Function::ExternalLinkage, declID, cgenContext->module.get());
-                functionTable->addToEnv(declID, func);
+                functionTable->addToEnv(declSym, func);
             }
             else
             {
-
-                if (varTable->table.size() == 1) // global variable
-                {
-
-                    GlobalVariable *globalVar = new GlobalVariable(*(cgenContext->module), declType->llvmType(cgenContext), false,
-                                                                   GlobalValue::ExternalLinkage, nullptr, declID);
-                    varTable->addToEnv(declID, globalVar);
-                }
-                else
-                {
-                    // local variable
-                    AllocaInst *alloca = cgenContext->builder->CreateAlloca(declType->llvmType(cgenContext), nullptr, declID);
-                    varTable->addToEnv(declID, alloca);
-                }
+                // a global without initializer is a tentative definition, i.e. zero initialized
+                // (common linkage, so other object files may define it as well)
+                llvm::Type *globalType = declType->llvmType(cgenContext);
+                GlobalVariable *globalVar = new GlobalVariable(*(cgenContext->module), globalType, false,
+                                                               GlobalValue::CommonLinkage,
+                                                               Constant::getNullValue(globalType), declID);
+                varTable->addToEnv(declSym, globalVar);
             }
+            return false;
+        }
+
+        Value *codeGen(CodeGenContext *cgenContext)
+        {
+            auto varTable = cgenContext->varTable;
+            assert(declType != nullptr);
+            // globals and function declarations were created by declare(), this is a local variable
+            assert(!isFunctionDecl && varTable->depth() > 1);
+            AllocaInst *alloca = cgenContext->builder->CreateAlloca(declType->llvmType(cgenContext), nullptr, declID);
+            varTable->addToEnv(declSym, alloca);
             return nullptr;
         }
     };
@@ -972,7 +1219,7 @@ namespace ast
             bool ret = true;
             if (nodes.size() == 0)
             {
-                this->my_type = new SimpleType(TYPE_VOID);
+                this->my_type = SimpleType::get(TYPE_VOID);
                 return true;
             }
             for (auto node : nodes)
@@ -1061,7 +1308,7 @@ namespace ast
                 symTable->createNewEnv();
             }
             bool ret = true;
-            Type *last_type = new SimpleType(TYPE_VOID);
+            Type *last_type = SimpleType::get(TYPE_VOID);
             for (auto node : nodes)
             {
                 ret &= node->typeCheck(symTable);
@@ -1070,7 +1317,7 @@ namespace ast
                 {
                     // Expression statement cant have return statement
                     // Dont use their type
-                    new_type = new SimpleType(TYPE_VOID);
+                    new_type = SimpleType::get(TYPE_VOID);
                 }
                 else
                 {
@@ -1163,8 +1410,10 @@ namespace ast
         }
 
         Type *declType;
-        std::string declID;
-        std::vector<std::string> argNames;
+        std::string_view declID;
+        SymbolId declSym;
+        std::vector<std::string_view> argNames;
+        std::vector<SymbolId> argSyms;
 
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
@@ -1176,13 +1425,13 @@ namespace ast
             yyTypeSpecifier *typeSpec = declSpecs->getType();
             assert(typeSpec != nullptr);
 
-            Type *type = new SimpleType(typeSpec->type);
+            Type *type = SimpleType::get(typeSpec->type);
 
             yyDeclarator *decl = dynamic_cast<yyDeclarator *>(nodes[1]);
 
             if (decl->pointers.size() > 0)
             {
-                type = new PointerType(decl->pointers.size(), SimpleType(typeSpec->type));
+                type = PointerType::get(decl->pointers.size(), typeSpec->type);
             }
 
             yyDirectDeclarator *directDecl = dynamic_cast<yyDirectDeclarator *>(decl->directDeclarator);
@@ -1190,7 +1439,7 @@ namespace ast
             assert(directDecl->nodes.size() == 2);
             yyIdentifier *idNode = dynamic_cast<yyIdentifier *>(directDecl->nodes[0]);
             assert(idNode != nullptr);
-            std::string id = idNode->id;
+            std::string_view id = idNode->id;
 
             // function declarator
             symTable->createNewEnv();
@@ -1210,7 +1459,7 @@ namespace ast
                     std::cerr << "Fatal: Ellipsis not supported in function definition yet.." << std::endl;
                     exit(1);
                     // ellipsis = void*
-                    paramTypes.push_back(new PointerType(1, SimpleType(TYPE_VOID)));
+                    paramTypes.push_back(PointerType::get(1, TYPE_VOID));
                 }
                 else
                 {
@@ -1219,12 +1468,12 @@ namespace ast
                     assert(paramDeclSpecs != nullptr);
                     yyTypeSpecifier *paramTypeSpec = paramDeclSpecs->getType();
                     assert(paramTypeSpec != nullptr);
-                    Type *paramType = new SimpleType(paramTypeSpec->type);
+                    Type *paramType = SimpleType::get(paramTypeSpec->type);
                     yyDeclarator *paramDeclr = dynamic_cast<yyDeclarator *>(paramDecl->nodes[1]);
                     assert(paramDeclr != nullptr);
                     if (paramDeclr->pointers.size() > 0)
                     {
-                        paramType = new PointerType(paramDeclr->pointers.size(), SimpleType(paramTypeSpec->type));
+                        paramType = PointerType::get(paramDeclr->pointers.size(), paramTypeSpec->type);
                     }
                     paramTypes.push_back(paramType);
 
@@ -1234,21 +1483,23 @@ namespace ast
 
                     yyIdentifier *paramIdNode = dynamic_cast<yyIdentifier *>(paramDirectDecl->nodes[0]);
                     assert(paramIdNode != nullptr);
-                    std::string paramId = paramIdNode->id;
+                    std::string_view paramId = paramIdNode->id;
                     argNames.push_back(paramId);
+                    argSyms.push_back(paramIdNode->sym);
                     paramDecl->my_type = paramType;
 
-                    symTable->addToEnv(paramId, paramDecl);
+                    symTable->addToEnv(paramIdNode->sym, paramDecl);
                 }
             }
 
-            idNode->my_type = new FunctionType(paramTypes, type);
+            idNode->my_type = FunctionType::get(paramTypes, type);
 
             declID = idNode->id;
+            declSym = idNode->sym;
             declType = idNode->my_type;
 
             // Add function to symbol table, for recursive function calls in the body
-            symTable->addToEnv(idNode->id, idNode);
+            symTable->addToEnv(idNode->sym, idNode);
 
             yyCompoundStatement *body = dynamic_cast<yyCompoundStatement *>(nodes[2]);
             assert(body != nullptr);
@@ -1266,44 +1517,64 @@ namespace ast
                 ret = false;
             }
 
-            symTable->addToEnv(idNode->id, idNode);
+            symTable->addToEnv(idNode->sym, idNode);
 
             return ret;
         }
 
-        Value *codeGen(CodeGenContext *cgenContext)
+        bool declare(CodeGenContext *cgenContext)
         {
-
             auto varTable = cgenContext->varTable;
             auto functionTable = cgenContext->funcTable;
             assert(declType != nullptr);
 
-            assert(varTable->table.size() == 1);      // should be at TU level
-            assert(functionTable->table.size() == 1); // just for safety
+            assert(varTable->depth() == 1);      // should be at TU level
+            assert(functionTable->depth() == 1); // just for safety
 
             FunctionType *funcType = dynamic_cast<FunctionType *>(declType);
             assert(funcType != nullptr);
             auto llvmFuncType = funcType->llvmFuncType(cgenContext);
             Function *func = Function::Create(llvmFuncType, Function::ExternalLinkage, declID, cgenContext->module.get());
+            yyDeclSpecifiers *declSpecs = dynamic_cast<yyDeclSpecifiers *>(nodes[0]);
+            if (declSpecs != nullptr && declSpecs->isInline())
+            {
+                func->addFnAttr(Attribute::InlineHint);
+            }
 
             for (size_t i = 0; i < argNames.size(); i++)
             {
                 func->getArg(i)->setName(argNames[i]);
             }
 
-            functionTable->addToEnv(declID, func);
+            functionTable->addToEnv(declSym, func);
+            return true;
+        }
+
+        Value *codeGen(CodeGenContext *cgenContext)
+        {
+
+            auto varTable = cgenContext->varTable;
+            auto functionTable = cgenContext->funcTable;
+            assert(varTable->depth() == 1);      // should be at TU level
+            assert(functionTable->depth() == 1); // just for safety
+
+            FunctionType *funcType = dynamic_cast<FunctionType *>(declType);
+            assert(funcType != nullptr);
+            // created by declare()
+            Function *func = functionTable->getFromEnv(declSym);
+            assert(func != nullptr);
 
             BasicBlock *bb = BasicBlock::Create(*cgenContext->context, "entry", func);
             cgenContext->builder->SetInsertPoint(bb);
 
             varTable->createNewEnv();
 
-            for (auto &arg : func->args())
+            for (size_t i = 0; i < argSyms.size(); i++)
             {
-                auto argName = arg.getName();
-                AllocaInst *alloca = cgenContext->builder->CreateAlloca(arg.getType(), nullptr, argName);
-                cgenContext->builder->CreateStore(&arg, alloca);
-                varTable->addToEnv(argName.str(), alloca);
+                auto arg = func->getArg(i);
+                AllocaInst *alloca = cgenContext->builder->CreateAlloca(arg->getType(), nullptr, arg->getName());
+                cgenContext->builder->CreateStore(arg, alloca);
+                varTable->addToEnv(argSyms[i], alloca);
             }
 
             yyCompoundStatement *body = dynamic_cast<yyCompoundStatement *>(nodes[2]);
@@ -1361,8 +1632,11 @@ namespace ast
 
             varTable->popEnv();
 
-            if (verifyFunction(*func, &errs()))
+            if (verifyFunction(*func, nullptr))
             {
+                // with -codegen-threads other threads may be generating (and failing) too
+                std::lock_guard<std::mutex> guard(CodeGenContext::printLock);
+                verifyFunction(*func, &errs());
                 std::cerr << "\n[Line No " << this->line_no << "] Fatal Error: Codegen for Function " << declID << " didn't pass LLVM's verifyFunction" << std::endl;
                 std::cerr << "This most probably happened because function didn't have return statement in all control paths" << std::endl;
                 std::cerr << "Printing module so far.." << std::endl;
@@ -1489,7 +1763,7 @@ namespace ast
             yyIdentifier *id = dynamic_cast<yyIdentifier *>(lhs);
             assert(id != nullptr);
             auto varTable = CodeGenContext->varTable;
-            auto var = varTable->getFromEnv(id->id);
+            auto var = varTable->getFromEnv(id->sym);
             // var is a location in memory
             return var;
         }
@@ -1624,7 +1898,8 @@ namespace ast
 
         bool isFuncCall = false;
 
-        std::string funcName;
+        std::string_view funcName;
+        SymbolId funcSym;
 
         bool typeCheck(SymbolTable<yyAST *> *symTable)
         {
@@ -1650,126 +1925,126 @@ namespace ast
                     switch (binaryOp)
                     {
                     case BinaryOp::PLUS:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation + " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::MINUS:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation - " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::MULT:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation * " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::DIV:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation / " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::MOD:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation % " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::OR:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation | " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::AND:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation & " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::XOR:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation ^ " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::LSHIFT:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation << " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::RSHIFT:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation >> " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::GT:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation > " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::LT:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation < " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::GTE:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation >= " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::LTE:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation <= " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::EQUAL:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation == " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::NOT_EQUAL:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_INT)) || left->my_type->equals(new SimpleType(TYPE_FLOAT))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_INT)) || left->my_type->equals(SimpleType::get(TYPE_FLOAT))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation != " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::LOGICAL_AND:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_BOOL))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_BOOL))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation && " << std::endl;
                             ret = false;
                         }
                         break;
                     case BinaryOp::LOGICAL_OR:
-                        if (!(left->my_type->equals(new SimpleType(TYPE_BOOL))))
+                        if (!(left->my_type->equals(SimpleType::get(TYPE_BOOL))))
                         {
                             std::cerr << "[Line No " << this->line_no << "] Error: " << left->my_type->typeStr() << " is not supported for binary operation || " << std::endl;
                             ret = false;
@@ -1792,7 +2067,7 @@ namespace ast
 
                     if (logicalOperations.count(binaryOp) != 0)
                     {
-                        this->my_type = new SimpleType(TYPE_BOOL);
+                        this->my_type = SimpleType::get(TYPE_BOOL);
                     }
                     else
                     {
@@ -1822,19 +2097,20 @@ namespace ast
                     assert(funcNameId != nullptr);
 
                     funcName = funcNameId->id;
+                    funcSym = funcNameId->sym;
 
                     bool containsEllipsis = false;
 
                     for (auto param : funcType->paramTypes)
                     {
-                        if (param->equals(new SimpleType(TYPE_ELLIPSIS)))
+                        if (param->equals(SimpleType::get(TYPE_ELLIPSIS)))
                         {
                             containsEllipsis = true;
                             break;
                         }
                     }
 
-                    if (!containsEllipsis && funcType->paramTypes.size() != right->nodes.size() ||
+                    if ((!containsEllipsis && funcType->paramTypes.size() != right->nodes.size()) ||
                         (containsEllipsis && right->nodes.size() < (funcType->paramTypes.size() - 1)))
                     {
                         std::cerr << "[Line No " << this->line_no << "] Error: Incompatible number of arguments in function call: "
@@ -1888,11 +2164,11 @@ namespace ast
                 switch (binaryOp)
                 {
                 case BinaryOp::PLUS:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateAdd(lhs_val, rhs_val, "addtmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFAdd(lhs_val, rhs_val, "addtmp");
                     }
@@ -1902,11 +2178,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::MINUS:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateSub(lhs_val, rhs_val, "subtmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFSub(lhs_val, rhs_val, "subtmp");
                     }
@@ -1916,11 +2192,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::MULT:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateMul(lhs_val, rhs_val, "multmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFMul(lhs_val, rhs_val, "multmp");
                     }
@@ -1930,11 +2206,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::DIV:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateSDiv(lhs_val, rhs_val, "divtmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFDiv(lhs_val, rhs_val, "divtmp");
                     }
@@ -1944,7 +2220,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::MOD:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateSRem(lhs_val, rhs_val, "modtmp");
                     }
@@ -1954,7 +2230,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::OR:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateOr(lhs_val, rhs_val, "ortmp");
                     }
@@ -1964,7 +2240,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::AND:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateAnd(lhs_val, rhs_val, "andtmp");
                     }
@@ -1974,7 +2250,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::XOR:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateXor(lhs_val, rhs_val, "xortmp");
                     }
@@ -1984,7 +2260,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::LSHIFT:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateShl(lhs_val, rhs_val, "lshifttmp");
                     }
@@ -1994,7 +2270,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::RSHIFT:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateAShr(lhs_val, rhs_val, "rshifttmp");
                     }
@@ -2004,11 +2280,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::GT:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpSGT(lhs_val, rhs_val, "gttmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpOGT(lhs_val, rhs_val, "gttmp");
                     }
@@ -2018,11 +2294,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::GTE:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpSGE(lhs_val, rhs_val, "gtetmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpOGE(lhs_val, rhs_val, "gtetmp");
                     }
@@ -2032,11 +2308,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::LT:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpSLT(lhs_val, rhs_val, "lttmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpOLT(lhs_val, rhs_val, "lttmp");
                     }
@@ -2046,7 +2322,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::LOGICAL_AND:
-                    if (left->my_type->equals(new SimpleType(TYPE_BOOL)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_BOOL)))
                     {
                         tmp = cgenContext->builder->CreateLogicalAnd(lhs_val, rhs_val, "andtmp");
                     }
@@ -2056,7 +2332,7 @@ namespace ast
                     }
                     break;
                 case BinaryOp::LOGICAL_OR:
-                    if (left->my_type->equals(new SimpleType(TYPE_BOOL)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_BOOL)))
                     {
                         tmp = cgenContext->builder->CreateLogicalOr(lhs_val, rhs_val, "ortmp");
                     }
@@ -2066,15 +2342,15 @@ namespace ast
                     }
                     break;
                 case BinaryOp::EQUAL:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpEQ(lhs_val, rhs_val, "eqtmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpOEQ(lhs_val, rhs_val, "eqtmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_BOOL)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_BOOL)))
                     {
                         tmp = cgenContext->builder->CreateICmpEQ(lhs_val, rhs_val, "eqtmp");
                     }
@@ -2084,15 +2360,15 @@ namespace ast
                     }
                     break;
                 case BinaryOp::NOT_EQUAL:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpNE(lhs_val, rhs_val, "netmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpONE(lhs_val, rhs_val, "netmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_BOOL)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_BOOL)))
                     {
                         tmp = cgenContext->builder->CreateICmpNE(lhs_val, rhs_val, "netmp");
                     }
@@ -2102,11 +2378,11 @@ namespace ast
                     }
                     break;
                 case BinaryOp::LTE:
-                    if (left->my_type->equals(new SimpleType(TYPE_INT)))
+                    if (left->my_type->equals(SimpleType::get(TYPE_INT)))
                     {
                         tmp = cgenContext->builder->CreateICmpSLE(lhs_val, rhs_val, "ltetmp");
                     }
-                    else if (left->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    else if (left->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         tmp = cgenContext->builder->CreateFCmpOLE(lhs_val, rhs_val, "ltetmp");
                     }
@@ -2125,7 +2401,7 @@ namespace ast
             else
             {
                 // func call
-                auto func = cgenContext->funcTable->getFromEnv(funcName);
+                auto func = cgenContext->funcTable->getFromEnv(funcSym);
                 assert(func != nullptr);
 
                 std::vector<Value *> args;
@@ -2189,38 +2465,38 @@ namespace ast
             if (unaryOp == LOGICAL_NOT) // Logical not
             {
                 ret &= nodes[0]->typeCheck(symTable);
-                if (!nodes[0]->my_type->equals(new SimpleType(TYPE_BOOL)))
+                if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_BOOL)))
                 {
                     std::cerr << "[Line No " << this->line_no << "] Error: Incompatible types in unary operation: "
-                              << "Expected: " << (new SimpleType(TYPE_BOOL))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                              << "Expected: " << SimpleType::get(TYPE_BOOL)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                     ret = false;
                 }
                 else
                 {
-                    this->my_type = new SimpleType(TYPE_BOOL);
+                    this->my_type = SimpleType::get(TYPE_BOOL);
                 }
             }
             else if (unaryOp == NOT) // Bitwise not
             {
                 ret &= nodes[0]->typeCheck(symTable);
-                if (!nodes[0]->my_type->equals(new SimpleType(TYPE_INT)))
+                if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_INT)))
                 {
                     std::cerr << "[Line No " << this->line_no << "] Error: Incompatible types in unary operation: "
-                              << "Expected: " << (new SimpleType(TYPE_INT))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                              << "Expected: " << SimpleType::get(TYPE_INT)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                     ret = false;
                 }
                 else
                 {
-                    this->my_type = new SimpleType(TYPE_INT);
+                    this->my_type = SimpleType::get(TYPE_INT);
                 }
             }
             else if (unaryOp == UnaryOp::PL || unaryOp == UnaryOp::NEG)
             {
                 ret &= nodes[0]->typeCheck(symTable);
-                if (!nodes[0]->my_type->equals(new SimpleType(TYPE_INT)) && !nodes[0]->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_INT)) && !nodes[0]->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                 {
                     std::cerr << "[Line No " << this->line_no << "] Error: Incompatible type in unary operation: "
-                              << "Expected: " << (new SimpleType(TYPE_INT))->typeStr() << " or " << (new SimpleType(TYPE_FLOAT))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                              << "Expected: " << SimpleType::get(TYPE_INT)->typeStr() << " or " << SimpleType::get(TYPE_FLOAT)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                     ret = false;
                 }
                 else
@@ -2242,10 +2518,10 @@ namespace ast
                 }
                 else
                 {
-                    if (!nodes[0]->my_type->equals(new SimpleType(TYPE_INT)) && !nodes[0]->my_type->equals(new SimpleType(TYPE_FLOAT)))
+                    if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_INT)) && !nodes[0]->my_type->equals(SimpleType::get(TYPE_FLOAT)))
                     {
                         std::cerr << "[Line No " << this->line_no << "] Error: Incompatible type in unary operation: "
-                                  << "Expected: " << (new SimpleType(TYPE_INT))->typeStr() << " or " << (new SimpleType(TYPE_FLOAT))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                                  << "Expected: " << SimpleType::get(TYPE_INT)->typeStr() << " or " << SimpleType::get(TYPE_FLOAT)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                         ret = false;
                     }
                     else
@@ -2285,7 +2561,7 @@ namespace ast
                 assert(false && "should have been caught in typeCheck");
             }
 
-            Value *opr_loc = cgenContext->varTable->getFromEnv(idNode->id);
+            Value *opr_loc = cgenContext->varTable->getFromEnv(idNode->sym);
 
             assert(opr_loc != nullptr);
             auto c1 = ConstantInt::get(*(cgenContext->context), APInt(32, 1, true));
@@ -2381,10 +2657,10 @@ namespace ast
 
             // if-then
             res &= nodes[0]->typeCheck(symTable);
-            if (!nodes[0]->my_type->equals(new SimpleType(TYPE_BOOL)))
+            if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_BOOL)))
             {
                 std::cerr << "[Line No " << this->line_no << "] Error: Incompatible types in if-then: "
-                          << "Expected: " << (new SimpleType(TYPE_BOOL))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                          << "Expected: " << SimpleType::get(TYPE_BOOL)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                 res = false;
             }
 
@@ -2488,10 +2764,10 @@ namespace ast
 
             // while
             res &= nodes[0]->typeCheck(symTable);
-            if (!nodes[0]->my_type->equals(new SimpleType(TYPE_BOOL)))
+            if (!nodes[0]->my_type->equals(SimpleType::get(TYPE_BOOL)))
             {
                 std::cerr << "[Line No " << this->line_no << "] Error: Incompatible types in while: "
-                          << "Expected: " << (new SimpleType(TYPE_BOOL))->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
+                          << "Expected: " << SimpleType::get(TYPE_BOOL)->typeStr() << " but got " << nodes[0]->my_type->typeStr() << std::endl;
                 res = false;
             }
 
@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+# Generates synthetic C programs in the subset accepted by cc, for benchmarking.
+#
+#   gen.py <shape> <n> [-o file]
+#
+# shapes:
+#   functions    n small functions, each calling the previous one
+#   nesting      one function with if/while statements nested n deep
+#   expressions  one function with an expression chain of n terms
+#   locals       one function with n locals, all live across a loop
+#   strings      n printf calls, each with its own string literal
+
+import argparse
+import random
+import sys
+
+
+def functions(n):
+    out = ["int f0(int p) {\n    return p + 1;\n}"]
+    for i in range(1, n):
+        out.append(f"int f{i}(int p) {{\n"
+                   f"    int a;\n"
+                   f"    int b;\n"
+                   f"    a = p * {i % 7 + 2};\n"
+                   f"    b = f{i - 1}(a - {i});\n"
+                   f"    if (b > a) {{\n"
+                   f"        b = b - a;\n"
+                   f"    }}\n"
+                   f"    return a + b;\n"
+                   f"}}")
+    out.append(f"int main() {{\n    return f{n - 1}(1) % 256;\n}}")
+    return out
+
+
+# indentation stops growing after a few levels, otherwise the file size (and so the
+# scanning time) would grow quadratically with the depth
+def indent(depth):
+    return "    " * min(depth, 8)
+
+
+def nesting(n):
+    out = ["int deep(int p) {", "    int s;", "    s = 0;"]
+    for depth in range(n):
+        pad = indent(depth + 1)
+        v = f"i{depth}"
+        out.append(f"{pad}int {v};")
+        out.append(f"{pad}{v} = 0;")
+        if depth % 2 == 0:
+            out.append(f"{pad}while ({v} < p) {{")
+        else:
+            out.append(f"{pad}if (p > {depth}) {{")
+    out.append(f"{indent(n + 1)}s = s + p;")
+    for depth in reversed(range(n)):
+        pad = indent(depth + 1)
+        if depth % 2 == 0:
+            out.append(f"{pad}    i{depth} = i{depth} + 1;")
+        out.append(f"{pad}}}")
+    out.append("    return s;\n}")
+    out.append("int main() {\n    return deep(1) % 256;\n}")
+    return out
+
+
+def expressions(n):
+    rng = random.Random(n)
+    ops = ["+", "-", "*", "+", "-"]
+    terms = ["a"]
+    for i in range(1, n):
+        operand = rng.choice(["a", "b", "c", str(rng.randint(1, 9))])
+        terms.append(f"{rng.choice(ops)} {operand}")
+    lines = []
+    for i in range(0, len(terms), 12):
+        lines.append(" ".join(terms[i:i + 12]))
+    out = ["int chain(int a, int b, int c) {", "    int r;"]
+    out.append("    r = " + "\n        ".join(lines) + ";")
+    out.append("    return r;\n}")
+    out.append("int main() {\n    return chain(1, 2, 3) % 256;\n}")
+    return out
+
+
+def locals_(n):
+    out = ["int many(int p) {"]
+    for i in range(n):
+        out.append(f"    int v{i};")
+        out.append(f"    v{i} = p + {i};")
+    out.append("    int i;\n    i = 0;\n    while (i < p) {")
+    for i in range(n):
+        out.append(f"        v{i} = v{i} + v{(i * 7 + 1) % n};")
+    out.append("        i = i + 1;\n    }")
+    out.append("    int s;\n    s = 0;")
+    for i in range(n):
+        out.append(f"    s = s + v{i};")
+    out.append("    return s;\n}")
+    out.append("int main() {\n    return many(2) % 256;\n}")
+    return out
+
+
+def strings(n):
+    out = ["int printf(char const *format, ...);", "int main() {", "    int i;", "    i = 0;"]
+    for i in range(n):
+        out.append(f'    printf("message {i}: value %d\\n", i);')
+        out.append(f"    i = i + {i % 5 + 1};")
+    out.append("    return i % 256;\n}")
+    return out
+
+
+SHAPES = {
+    "functions": functions,
+    "nesting": nesting,
+    "expressions": expressions,
+    "locals": locals_,
+    "strings": strings,
+}
+
+
+def generate(shape, n):
+    return "\n".join(SHAPES[shape](n)) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="generate a synthetic C program for benchmarking cc")
+    parser.add_argument("shape", choices=sorted(SHAPES))
+    parser.add_argument("n", type=int)
+    parser.add_argument("-o", dest="output", help="output file (default: stdout)")
+    args = parser.parse_args()
+    if args.n < 1:
+        print("gen.py: n must be at least 1", file=sys.stderr)
+        return 1
+    source = generate(args.shape, args.n)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(source)
+    else:
+        sys.stdout.write(source)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
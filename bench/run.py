@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Compiles the generated benchmark programs at growing sizes with -ftime-report and
+# prints the time of every compiler phase, the time per KLOC and how the time grows
+# when the input doubles (growth ~1.0 is linear, ~2.0 quadratic).
+#
+#   run.py [--cc ./cc] [--out bench/out] [--scale k] [--shapes a,b,..]
+
+import argparse
+import csv
+import os
+import subprocess
+import sys
+
+import gen
+
+# start size of every shape, each is compiled at size, 2 x size and 4 x size
+SIZES = {
+    "functions": 1000,
+    "nesting": 128,
+    "expressions": 2000,
+    "locals": 1000,
+    "strings": 2000,
+}
+PHASES = ["parse", "env check", "type check", "codegen", "optimize", "verify", "emit", "total"]
+
+
+# runs cc once and returns {phase: wall ms}, or None if the compilation failed
+def compile_once(cc, path):
+    result = subprocess.run([cc, "-ftime-report", "--emit=none", path],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr)
+        return None
+    times = {}
+    for line in result.stderr.splitlines():
+        for phase in PHASES:
+            rest = line[len(phase):].split()
+            if line.startswith(phase) and rest and rest[0].replace(".", "", 1).isdigit():
+                times[phase] = float(rest[0])
+    return times
+
+
+# best of several runs, per phase
+def compile_best(cc, path, runs):
+    best = None
+    for _ in range(runs):
+        times = compile_once(cc, path)
+        if times is None:
+            return None
+        if best is None or times["total"] < best["total"]:
+            best = times
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description="benchmark cc on generated inputs")
+    parser.add_argument("--cc", default="./cc", help="compiler to run (default: ./cc)")
+    parser.add_argument("--out", default=os.path.join(os.path.dirname(__file__), "out"),
+                        help="directory for the generated programs and results.csv")
+    parser.add_argument("--scale", type=float, default=1.0, help="multiply every start size by this")
+    parser.add_argument("--runs", type=int, default=3, help="runs per input, the fastest is kept")
+    parser.add_argument("--shapes", default=",".join(SIZES), help="comma separated shapes to run")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    rows = []
+    header = "{:<12} {:>6} {:>7}".format("shape", "n", "lines")
+    header += "".join("{:>11}".format(p) for p in PHASES)
+    header += "{:>10} {:>7}".format("ms/kloc", "growth")
+    print(header)
+    for shape in args.shapes.split(","):
+        if shape not in SIZES:
+            print("run.py: unknown shape " + shape, file=sys.stderr)
+            return 1
+        previous = None
+        for factor in (1, 2, 4):
+            n = max(1, int(SIZES[shape] * args.scale)) * factor
+            path = os.path.join(args.out, "{}-{}.c".format(shape, n))
+            source = gen.generate(shape, n)
+            with open(path, "w") as f:
+                f.write(source)
+            lines = source.count("\n")
+
+            times = compile_best(args.cc, path, args.runs)
+            if times is None:
+                print("run.py: {} failed to compile".format(path), file=sys.stderr)
+                return 1
+            perKloc = times["total"] / (lines / 1000.0)
+            growth = times["total"] / previous if previous else None
+            previous = times["total"]
+
+            row = "{:<12} {:>6} {:>7}".format(shape, n, lines)
+            row += "".join("{:>11.1f}".format(times.get(p, 0.0)) for p in PHASES)
+            row += "{:>10.1f} {:>7}".format(perKloc, "{:.2f}".format(growth / 2) if growth else "-")
+            print(row, flush=True)
+            rows.append([shape, n, lines] + [times.get(p, 0.0) for p in PHASES] + [perKloc])
+
+    with open(os.path.join(args.out, "results.csv"), "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["shape", "n", "lines"] + [p.replace(" ", "_") + "_ms" for p in PHASES] + ["ms_per_kloc"])
+        writer.writerows(rows)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -3,8 +3,23 @@
 %code requires {
 	#include <iostream>
 	#include "ast.h"
+
+	// the scanner handle of the reentrant flex scanner (same typedef as in c.lex.cpp)
+	#ifndef YY_TYPEDEF_YY_SCANNER_T
+	#define YY_TYPEDEF_YY_SCANNER_T
+	typedef void *yyscan_t;
+	#endif
 }
 
+%code provides {
+	// stuff from flex that bison needs to know about:
+	int yylex(YYSTYPE *yylval_param, yyscan_t yyscanner);
+	void yyerror(yyscan_t scanner, ast::yyTU *topLevelTU, const char *s);
+
+	// parses a whole file with a scanner of its own, returns nullptr on errors.
+	// nothing is shared between two calls, so files can be parsed concurrently.
+	ast::yyTU *parseFile(const char *filename);
+}
 
 %{
 #include <cstdio>
@@ -14,21 +29,18 @@
 #include "ast.h"
 using namespace std;
 using namespace ast;
-
-extern yyTU* topLevelTU;
-
-// stuff from flex that bison needs to know about:
-extern "C" int yylex();
-int yyparse();
-extern "C" FILE *yyin;
-
-void yyerror(const char *s);
 %}
 
+// no globals: the scanner and the translation unit being built are parameters
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {ast::yyTU *topLevelTU}
+
 %union {
   int int_val;
   float float_val;
   char* str_val;   // "string type has a non-trivial copy constructor"
+  SymbolId sym_id; // identifiers and string literals, pooled by the lexer
   ast::yyAST* ast_node;
   ast::UnaryOp un_op;
   ast::AssignOp assign_op;
@@ -47,11 +59,12 @@ void yyerror(const char *s);
 %type <ast_node> multiplicative_expression cast_expression unary_expression postfix_expression primary_expression
 %type <un_op>    unary_operator
 %type <ast_node> argument_expression_list constant pointer init_declarator_list init_declarator
-%type <ast_node> string type_qualifier
+%type <ast_node> string type_qualifier function_specifier
 %type <assign_op> assignment_operator
 
 
-%token	<str_val> IDENTIFIER STRING_LITERAL FUNC_NAME
+%token	<sym_id> IDENTIFIER STRING_LITERAL
+%token	<str_val> FUNC_NAME
 %token  <int_val> I_CONSTANT
 %token  <float_val> F_CONSTANT
 %token  SIZEOF
@@ -95,7 +108,7 @@ enumeration_constant		/* before it has been defined as such */
 	;
 
 string
-	: STRING_LITERAL {$$ = new yyStringLiteral($1);}
+	: STRING_LITERAL {$$ = new yyStringLiteral($1); topLevelTU->addStringLiteral($$);}
 	| FUNC_NAME
 	;
 
@@ -319,7 +332,7 @@ expression
 	: assignment_expression {$$ = new yyExpression($1);}
 	| expression ',' assignment_expression
 	{
-		throw std::logic_error("Line No: " + std::to_string(yylineno)  + ", multiple expressions using ',' Not implemented yet");
+		throw std::logic_error("Line No: " + std::to_string(parseLineNo)  + ", multiple expressions using ',' Not implemented yet");
 	    /*
 		yyExpression* dollar_1_casted = dynamic_cast<yyExpression*> ($1);
 	    assert(dollar_1_casted != nullptr);
@@ -346,19 +359,19 @@ declaration_specifiers
 	| type_specifier {$$ = new yyDeclSpecifiers($1);}
 	| type_qualifier declaration_specifiers  {$$ = $2; $$->addNode($1);}
 	| type_qualifier {$$ = new yyDeclSpecifiers(); $$->addNode($1);}
-	| function_specifier declaration_specifiers
-	| function_specifier
+	| function_specifier declaration_specifiers {$$ = $2; $$->addNode($1);}
+	| function_specifier {$$ = new yyDeclSpecifiers(); $$->addNode($1);}
 	| alignment_specifier declaration_specifiers
 	| alignment_specifier
 	;
 
 init_declarator_list
 	: init_declarator {$$ = new yyAST(); $$->addNode($1);}
-	| init_declarator_list ',' init_declarator {throw std::logic_error("Line No: " + std::to_string(yylineno)  + ", multiple declaration using ',' Not implemented yet");}
+	| init_declarator_list ',' init_declarator {throw std::logic_error("Line No: " + std::to_string(parseLineNo)  + ", multiple declaration using ',' Not implemented yet");}
 	;
 
 init_declarator
-	: declarator '=' initializer {throw std::logic_error("Line No: " + std::to_string(yylineno)  + ", decl = init Not implemented yet");}
+	: declarator '=' initializer {throw std::logic_error("Line No: " + std::to_string(parseLineNo)  + ", decl = init Not implemented yet");}
 	| declarator {$$ = $1;}
 	;
 
@@ -460,8 +473,8 @@ type_qualifier
 	;
 
 function_specifier
-	: INLINE
-	| NORETURN
+	: INLINE {$$ = new yyFunctionSpecifier(FunctionSpecifier::INLINE);}
+	| NORETURN {throw std::logic_error("Line No: " + std::to_string(parseLineNo)  + ", _Noreturn Not implemented yet");}
 	;
 
 alignment_specifier
@@ -726,9 +739,79 @@ declaration_list
 
 %%
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "c.lex.hpp"
 
-void yyerror(const char *s)
+void yyerror(yyscan_t scanner, ast::yyTU *topLevelTU, const char *s)
 {
 	fflush(stdout);
 	fprintf(stderr, "*** %s\n", s);
 }
+
+ast::yyTU *parseFile(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		std::cerr << "cc: can't read " << filename << std::endl;
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		std::cerr << "cc: can't read " << filename << std::endl;
+		return nullptr;
+	}
+
+	// flex scans the buffer in place, it has to end with two YY_END_OF_BUFFER_CHARs (0)
+	// and must be writable (flex temporarily terminates yytext in it)
+	size_t size = st.st_size;
+	size_t bufferSize = size + 2;
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	char *buffer;
+	if (size > 0 && size % pageSize != 0 && size % pageSize <= pageSize - 2)
+	{
+		// the tail of the last page of a file mapping reads as zeros. A private mapping
+		// is copy on write, only the pages flex writes to are copied.
+		buffer = (char *)mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	else
+	{
+		// no room for the terminators in the last page, read into zeroed memory instead
+		buffer = (char *)mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		for (size_t done = 0; buffer != MAP_FAILED && done < size;)
+		{
+			ssize_t n = read(fd, buffer + done, size - done);
+			if (n <= 0)
+			{
+				munmap(buffer, bufferSize);
+				buffer = (char *)MAP_FAILED;
+				break;
+			}
+			done += n;
+		}
+	}
+	close(fd);
+	if (buffer == MAP_FAILED)
+	{
+		std::cerr << "cc: can't read " << filename << std::endl;
+		return nullptr;
+	}
+
+	yyscan_t scanner;
+	yylex_init(&scanner);
+	yy_scan_buffer(buffer, bufferSize, scanner);
+	parseLineNo = 1;
+
+	ast::yyTU *topLevelTU = new ast::yyTU();
+	int ret = yyparse(scanner, topLevelTU);
+
+	yylex_destroy(scanner);
+	// the ast only refers to the string pool, never to the buffer
+	munmap(buffer, bufferSize);
+	return ret == 0 ? topLevelTU : nullptr;
+}
@@ -2,131 +2,774 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <iostream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
 #include "ast.h"
 #include "SymbolTable.h"
 #include "code_optimization.h"
+#include "code_emission.h"
 #include "c.tab.hpp"
+#include <llvm/Support/FileSystem.h>
 
-extern "C" int yylex();
-int yyparse();
-extern "C" FILE *yyin;
 
 static void usage()
 {
-  printf("Usage: cc <prog.c> [-v]\n");
+  printf("Usage: cc <prog.c>... [-j <n>] [-S|-emit-llvm-bc|-c|--run|--emit=<kind>] [-o <file>] [-v] [--verify-each] [-O0|-O1|-O2|-O3] [-passes=<p1,p2,..>] [-opt-stats[=text|json]] [-opt-threads=<n>] [-inline-threshold=<n>] [-unroll-threshold=<n>] [-unroll-count=<n>] [-codegen-threads=<n>] [-mem-report] [-codegen-stats] [-ftime-report]\n");
+  printf("  -j <n>             compile up to n translation units in parallel (default: all cores)\n");
+  printf("  -S                 write textual LLVM IR (the default, to stdout unless -o is given)\n");
+  printf("  -emit-llvm-bc      write LLVM bitcode (<prog>.bc unless -o is given)\n");
+  printf("  -c                 write a native object file (<prog>.o unless -o is given)\n");
+  printf("  -o <file>          output file; without one of the flags above the kind follows the\n");
+  printf("                     extension (.ll IR, .bc bitcode, .o object), anything else is an\n");
+  printf("                     executable linked with the system linker\n");
+  printf("                     with several input files -S, -emit-llvm-bc and -c write one file per\n");
+  printf("                     input, -o links the modules into one (not possible with -c)\n");
+  printf("  --run              jit compile the program, run main and exit with its return value\n");
+  printf("  --emit=<kind>      ir, bc, obj, exe, run or none (compile but write nothing, for benchmarking)\n");
+  printf("  -v                 print the AST, symbol table and optimizer statistics\n");
+  printf("  --verify-each      verify the IR after codegen and after every optimizer sub-pass\n");
+  printf("  -O0                only run our own optimizer passes (default)\n");
+  printf("  -O1, -O2, -O3      also run LLVM's default pipeline of that level after our passes\n");
+  printf("  -passes=<list>     comma separated optimizer pipeline (default: mem2reg,constfold,inline,gvn,licm,indvars,unroll)\n");
+  printf("  -opt-stats[=json]  print per-pass time and instruction counts to stderr\n");
+  printf("  -opt-threads=<n>   run the per-function optimizer passes on n threads\n");
+  printf("  -inline-threshold=<n> inline callees of up to n instructions (default: 40), `inline` ones always\n");
+  printf("  -unroll-threshold=<n> max size in instructions of an unrolled loop (default: 150, 0 disables unrolling)\n");
+  printf("  -unroll-count=<n>  copies of the body when a loop is unrolled partially (default: 4)\n");
+  printf("  -codegen-threads=<n> generate the function bodies on n threads\n");
+  printf("  -mem-report        print arena usage and peak memory to stderr\n");
+  printf("  -codegen-stats     print the hit rate of the llvm type cache to stderr\n");
+  printf("  -ftime-report      print time, allocations and peak memory of every compiler phase,\n");
+  printf("                     ast node and instruction counts to stderr (units are compiled one by one)\n");
 }
 
-using namespace std;
-using namespace ast;
+static void printMemReport(Arena &arena, std::ostream &out)
+{
+  out << "===--- Memory usage ---===" << std::endl;
+  out << "ast/type objects         " << arena.allocations << std::endl;
+  out << "ast/type bytes           " << arena.bytesAllocated << std::endl;
+  // one malloc per chunk instead of one per object
+  out << "arena chunks (mallocs)   " << arena.chunkCount() << std::endl;
+  out << "arena reserved bytes     " << arena.bytesReserved() << std::endl;
+  out << "peak rss (KB)            " << peakRSSKilobytes() << std::endl;
+}
 
-yyTU *topLevelTU = new yyTU();
+// what the compiler produces at the end
+enum EmitKind
+{
+  EMIT_DEFAULT, // decided by the extension of -o
+  EMIT_IR,
+  EMIT_BITCODE,
+  EMIT_OBJECT,
+  EMIT_EXECUTABLE,
+  EMIT_RUN,
+  EMIT_NONE
+};
 
-int main(int argc, char **argv)
+// the command line, shared (read only) by all translation units
+struct CompileOptions
+{
+  bool verbose = false;
+  bool memReport = false;
+  bool codegenStats = false;
+  bool verifyEach = false;
+  bool optStats = false;
+  bool optStatsJson = false;
+  bool timeReport = false;
+  unsigned optThreads = 1;
+  unsigned inlineThreshold = 40;
+  unsigned unrollThreshold = 150;
+  unsigned unrollCount = 4;
+  unsigned codegenThreads = 1;
+  std::vector<std::string> pipeline = {"mem2reg", "constfold", "inline", "gvn", "licm", "indvars", "unroll"};
+  EmitKind emitKind = EMIT_DEFAULT;
+};
+
+// wall / cpu time, heap allocations and peak rss of the phases of a unit (-ftime-report).
+// cpu time, allocations and rss are of the whole process, the threads of -codegen-threads
+// and -opt-threads included, so units are compiled one at a time for the report.
+class PhaseTimer
 {
+public:
+  struct Phase
+  {
+    std::string name;
+    double wallSeconds;
+    double cpuSeconds;
+    long allocations;
+    long peakRSS;
+  };
+  std::vector<Phase> phases;
 
-  if (argc < 2)
+  void start(const char *name)
   {
-    usage();
-    exit(1);
+    current = name;
+    startWall = std::chrono::steady_clock::now();
+    startCpu = std::clock();
+    startAllocations = allocationCount();
   }
-  char const *filename = argv[1];
-  yyin = fopen(filename, "r");
-  assert(yyin);
 
-  bool verbose = false;
-  if (argc > 2)
+  void stop()
   {
-    if (strcmp(argv[2], "-v") == 0)
-    {
-      verbose = true;
-    }
-    else
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - startWall).count();
+    double cpu = double(std::clock() - startCpu) / CLOCKS_PER_SEC;
+    phases.push_back({current, wall, cpu, allocationCount() - startAllocations, peakRSSKilobytes()});
+  }
+
+  void print(std::ostream &out)
+  {
+    out << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "wall(ms)" << std::setw(12)
+        << "cpu(ms)" << std::setw(12) << "allocs" << std::setw(16) << "peak rss(KB)" << std::endl;
+    Phase total = {"total", 0, 0, 0, 0};
+    for (auto &phase : phases)
     {
-      usage();
-      exit(1);
+      printPhase(phase, out);
+      total.wallSeconds += phase.wallSeconds;
+      total.cpuSeconds += phase.cpuSeconds;
+      total.allocations += phase.allocations;
+      total.peakRSS = phase.peakRSS;
     }
+    printPhase(total, out);
+    out.unsetf(std::ios::floatfield);
   }
 
-  int ret = yyparse();
+private:
+  std::string current;
+  std::chrono::steady_clock::time_point startWall;
+  std::clock_t startCpu;
+  long startAllocations;
 
-  if (ret != 0)
+  static void printPhase(const Phase &phase, std::ostream &out)
   {
-    std::cerr << "Compilation failed! [Parsing]" << std::endl;
+    out << std::left << std::setw(16) << phase.name << std::right << std::fixed << std::setprecision(3)
+        << std::setw(12) << phase.wallSeconds * 1000 << std::setw(12) << phase.cpuSeconds * 1000 << std::setw(12)
+        << phase.allocations << std::setw(16) << phase.peakRSS << std::endl;
+  }
+};
+
+// one translation unit and what compiling it produced
+struct CompileJob
+{
+  const char *filename;
+  // written by the worker, empty if the module is kept for main (stdout, --run, linking)
+  std::string outputFile;
+  int status = 0;
+  std::unique_ptr<LLVMContext> context;
+  std::unique_ptr<Module> module;
+  // statistics of this unit, printed by main in the order of the input files
+  std::ostringstream report;
+  // -ftime-report
+  PhaseTimer timer;
+  std::map<std::string, long> astNodes;
+  long instructionsBefore = 0;
+  long instructionsAfter = 0;
+};
+
+static bool endsWith(const std::string &str, const std::string &suffix)
+{
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+static void printTimeReport(CompileJob &job, std::ostream &out)
+{
+  out << "===--- Compiler phases (" << job.filename << ") ---===" << std::endl;
+  job.timer.print(out);
+
+  // most frequent node kinds first
+  std::vector<std::pair<long, std::string>> kinds;
+  long nodes = 0;
+  for (auto &entry : job.astNodes)
+  {
+    kinds.push_back(std::make_pair(entry.second, entry.first));
+    nodes += entry.second;
+  }
+  std::sort(kinds.rbegin(), kinds.rend());
+  out << std::left << std::setw(28) << "ast nodes" << nodes << std::endl;
+  for (auto &kind : kinds)
+  {
+    out << "  " << std::setw(26) << kind.second << kind.first << std::endl;
+  }
+  out << std::setw(28) << "instructions before opt" << job.instructionsBefore << std::endl;
+  out << std::setw(28) << "instructions after opt" << job.instructionsAfter << std::endl;
+  out << std::right;
+}
+
+// foo/bar.c -> bar, like other compilers the outputs go to the current directory
+static std::string outputBase(const char *filename)
+{
+  std::string base = filename;
+  base = base.substr(base.find_last_of('/') + 1);
+  return base.substr(0, base.find_last_of('.'));
+}
+
+using namespace std;
+using namespace ast;
+
+// points the thread's current arena, types and symbols at those of one unit, and back to
+// nullptr when the unit is done, they live on compileUnit's stack
+struct UnitScope
+{
+  UnitScope(Arena *arena, TypeContext *types, SymbolInterner *symbols)
+  {
+    Arena::current = arena;
+    TypeContext::current = types;
+    SymbolInterner::current = symbols;
+  }
+  ~UnitScope()
+  {
+    Arena::current = nullptr;
+    TypeContext::current = nullptr;
+    SymbolInterner::current = nullptr;
+  }
+};
+
+// parses, checks, generates and optimizes one translation unit, and writes its output
+// file if it has one. Every unit has its own arena, types, symbols and LLVMContext, so
+// units can be compiled on different threads.
+static void compileUnit(CompileJob &job, const CompileOptions &options)
+{
+  // all ast nodes and types of this unit, freed in one go when it is done
+  Arena arena;
+  TypeContext types;
+  SymbolInterner symbols;
+  UnitScope scope(&arena, &types, &symbols);
+
+  bool emitNative = options.emitKind == EMIT_OBJECT || options.emitKind == EMIT_EXECUTABLE ||
+                    options.emitKind == EMIT_RUN;
+  job.timer.start("parse");
+  yyTU *topLevelTU = parseFile(job.filename);
+  job.timer.stop();
+
+  if (topLevelTU == nullptr)
+  {
+    std::cerr << job.filename << ": Compilation failed! [Parsing]" << std::endl;
+    job.status = 1;
   }
   else
   {
+    if (options.timeReport)
+    {
+      topLevelTU->countNodes(job.astNodes);
+    }
     SymbolTable<yyAST *> *symTable = new SymbolTable<yyAST *>();
-    if (!topLevelTU->envCheck(symTable))
+    job.timer.start("env check");
+    bool envOk = topLevelTU->envCheck(symTable);
+    job.timer.stop();
+    if (!envOk)
     {
-      std::cerr << "Compilation failed! [Environment check]" << std::endl;
-      return 1;
+      std::cerr << job.filename << ": Compilation failed! [Environment check]" << std::endl;
+      job.status = 1;
     }
     else
     {
-      assert(symTable->table.size() == 1);
+      assert(symTable->depth() == 1);
       SymbolTable<yyAST *> *symTable = new SymbolTable<yyAST *>();
 
-      if (!topLevelTU->typeCheck(symTable))
+      job.timer.start("type check");
+      bool typesOk = topLevelTU->typeCheck(symTable);
+      job.timer.stop();
+      if (!typesOk)
       {
-        std::cerr << "Compilation failed! [Type Check]" << std::endl;
-        return 1;
+        std::cerr << job.filename << ": Compilation failed! [Type Check]" << std::endl;
+        job.status = 1;
       }
       else
       {
-        assert(symTable->table.size() == 1);
+        assert(symTable->depth() == 1);
 
-        if (verbose)
+        if (options.verbose)
         {
-          for (auto symbol : symTable->table[0])
+          for (auto symbol : symTable->globals())
           {
-            std::cout << symbol.first << ": " << symbol.second->my_type->typeStr() << "\n";
+            std::cout << symbols.name(symbol.first) << ": " << symbol.second->my_type->typeStr() << "\n";
           }
           std::cout << "Compilation successful!" << std::endl;
           topLevelTU->print();
         }
 
         CodeGenContext *context = new CodeGenContext();
+        context->threads = options.codegenThreads;
 
+        job.timer.start("codegen");
         topLevelTU->codeGen(context);
+        job.timer.stop();
 
-        if (!verifyModule(*context->module, &errs()))
+        // codegen already verifies every function it emits, the module as a whole is
+        // verified once after optimization unless --verify-each asks for more
+        if (options.verifyEach && verifyModule(*context->module, &errs()))
         {
-          if (verbose)
-          {
-            std::cout << "Code generation successful!" << std::endl;
-            context->module->print(errs(), nullptr);
-          }
-          // only print the code in non-verbose mode
+          std::cerr << job.filename << ": Code generation failed! [Code Gen]" << std::endl;
+          job.status = 1;
+          return;
         }
-        else
+        if (options.codegenStats)
         {
-          std::cerr << "Code generation failed! [Code Gen]" << std::endl;
-          return 1;
+          long lookups = context->typeCacheHits + context->typeCacheMisses;
+          job.report << "llvm type cache: " << lookups << " lookups, " << context->typeCacheHits << " hits ("
+                     << (lookups ? 100.0 * context->typeCacheHits / lookups : 0.0) << "%), "
+                     << context->loweredTypes.size() << " types lowered" << std::endl;
+        }
+        if (options.verbose)
+        {
+          std::cout << "Code generation successful!" << std::endl;
+          context->module->print(errs(), nullptr);
         }
         std::cout << std::flush;
 
         CodeOptContext *codeOptContext = new CodeOptContext(context->context.get(),
                                                             context->module.get(),
                                                             context->builder.get());
+        codeOptContext->verifyEach = options.verifyEach;
+        codeOptContext->pipeline = options.pipeline;
+        codeOptContext->threads = options.optThreads;
+        codeOptContext->inlineThreshold = options.inlineThreshold;
+        codeOptContext->unrollThreshold = options.unrollThreshold;
+        codeOptContext->unrollCount = options.unrollCount;
+
+        // a target machine can't be shared between threads, every unit creates its own
+        std::unique_ptr<TargetMachine> targetMachine;
+        if (emitNative)
+        {
+          std::string error;
+          targetMachine = createHostTargetMachine(error);
+          if (targetMachine == nullptr)
+          {
+            std::cerr << "cc: " << error << std::endl;
+            job.status = 1;
+            return;
+          }
+          setModuleTarget(context->module.get(), targetMachine.get());
+          codeOptContext->targetMachine = targetMachine.get();
+        }
 
+        job.instructionsBefore = countInstructions(context->module.get());
+        job.timer.start("optimize");
         optimize(codeOptContext);
+        job.timer.stop();
+        job.instructionsAfter = countInstructions(context->module.get());
 
-        if (!verifyModule(*context->module, &errs()))
+        if (options.optStats)
+        {
+          printOptStats(codeOptContext, job.report, options.optStatsJson);
+        }
+        if (options.memReport)
         {
-          if (verbose)
+          printMemReport(arena, job.report);
+        }
+
+        job.timer.start("verify");
+        bool broken = verifyModule(*context->module, &errs());
+        job.timer.stop();
+        if (!broken)
+        {
+          if (options.verbose)
           {
             std::cout << "Code optimization successful! [Code Opt]" << std::endl;
+            printOptStats(codeOptContext, std::cerr);
           }
 
-          // only print the code in non-verbose mode
-          context->module->print(outs(), nullptr);
+          std::string error;
+          bool ok = true;
+          job.timer.start("emit");
+          switch (options.emitKind)
+          {
+          case EMIT_DEFAULT: // resolved from -o by main
+          case EMIT_NONE:
+          case EMIT_RUN:
+            break;
+          case EMIT_IR:
+            if (!job.outputFile.empty())
+            {
+              ok = emitIRFile(context->module.get(), job.outputFile, error);
+            }
+            break;
+          case EMIT_BITCODE:
+            if (!job.outputFile.empty())
+            {
+              ok = emitBitcodeFile(context->module.get(), job.outputFile, error);
+            }
+            break;
+          case EMIT_OBJECT:
+          case EMIT_EXECUTABLE:
+            ok = emitObjectFile(context->module.get(), targetMachine.get(), job.outputFile, error);
+            break;
+          }
+          job.timer.stop();
+          if (!ok)
+          {
+            std::cerr << "cc: " << error << std::endl;
+            job.status = 1;
+            return;
+          }
+          // the module outlives the unit's arena, it only refers to llvm objects
+          job.context = std::move(context->context);
+          job.module = std::move(context->module);
         }
         else
         {
-          return 1;
+          std::cerr << job.filename << ": Code optimization failed! [Code Opt]" << std::endl;
+          job.status = 1;
         }
       }
     }
   }
+}
+
+// compiles the units on `workers` threads. Every thread takes the next unit nobody has
+// claimed yet, the biggest files go first so a large unit doesn't start last.
+static void compileAll(std::vector<CompileJob> &jobs, const CompileOptions &options, unsigned workers)
+{
+  std::vector<std::pair<uint64_t, size_t>> order;
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    uint64_t size = 0;
+    sys::fs::file_size(jobs[i].filename, size);
+    order.push_back(std::make_pair(size, i));
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b)
+                   { return a.first > b.first; });
+
+  std::atomic<size_t> next(0);
+  auto work = [&]()
+  {
+    for (size_t claimed = next++; claimed < order.size(); claimed = next++)
+    {
+      compileUnit(jobs[order[claimed].second], options);
+    }
+  };
+
+  // a single unit is compiled on the main thread, with its larger stack
+  workers = std::min<size_t>(workers, jobs.size());
+  if (workers <= 1)
+  {
+    work();
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < workers; i++)
+  {
+    threads.emplace_back(work);
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  CompileOptions options;
+  std::vector<const char *> filenames;
+  char const *llvmOptLevel = nullptr;
+  std::string outputFile;
+  unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+    {
+      options.verbose = true;
+    }
+    else if (strcmp(argv[i], "--verify-each") == 0)
+    {
+      options.verifyEach = true;
+    }
+    else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--emit=ir") == 0)
+    {
+      options.emitKind = EMIT_IR;
+    }
+    else if (strcmp(argv[i], "-emit-llvm-bc") == 0 || strcmp(argv[i], "--emit=bc") == 0)
+    {
+      options.emitKind = EMIT_BITCODE;
+    }
+    else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--emit=obj") == 0)
+    {
+      options.emitKind = EMIT_OBJECT;
+    }
+    else if (strcmp(argv[i], "--emit=exe") == 0)
+    {
+      options.emitKind = EMIT_EXECUTABLE;
+    }
+    else if (strcmp(argv[i], "--run") == 0 || strcmp(argv[i], "--emit=run") == 0)
+    {
+      options.emitKind = EMIT_RUN;
+    }
+    else if (strcmp(argv[i], "--emit=none") == 0)
+    {
+      options.emitKind = EMIT_NONE;
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+    {
+      outputFile = argv[++i];
+    }
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+    {
+      workers = atoi(argv[++i]);
+    }
+    else if (strncmp(argv[i], "-j", 2) == 0 && atoi(argv[i] + 2) > 0)
+    {
+      workers = atoi(argv[i] + 2);
+    }
+    else if (strcmp(argv[i], "-O0") == 0)
+    {
+      llvmOptLevel = nullptr;
+    }
+    else if (strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0 || strcmp(argv[i], "-O3") == 0)
+    {
+      llvmOptLevel = argv[i] + 1;
+    }
+    else if (strncmp(argv[i], "-passes=", 8) == 0)
+    {
+      std::string error;
+      if (!parsePipeline(argv[i] + 8, options.pipeline, error))
+      {
+        std::cerr << "cc: " << error << std::endl;
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "-opt-stats") == 0 || strcmp(argv[i], "-opt-stats=text") == 0)
+    {
+      options.optStats = true;
+    }
+    else if (strncmp(argv[i], "-opt-threads=", 13) == 0 && atoi(argv[i] + 13) > 0)
+    {
+      options.optThreads = atoi(argv[i] + 13);
+    }
+    else if (strncmp(argv[i], "-inline-threshold=", 18) == 0 && atoi(argv[i] + 18) >= 0)
+    {
+      options.inlineThreshold = atoi(argv[i] + 18);
+    }
+    else if (strncmp(argv[i], "-unroll-threshold=", 18) == 0 && atoi(argv[i] + 18) >= 0)
+    {
+      options.unrollThreshold = atoi(argv[i] + 18);
+    }
+    else if (strncmp(argv[i], "-unroll-count=", 14) == 0 && atoi(argv[i] + 14) > 0)
+    {
+      options.unrollCount = atoi(argv[i] + 14);
+    }
+    else if (strncmp(argv[i], "-codegen-threads=", 17) == 0 && atoi(argv[i] + 17) > 0)
+    {
+      options.codegenThreads = atoi(argv[i] + 17);
+    }
+    else if (strcmp(argv[i], "-mem-report") == 0)
+    {
+      options.memReport = true;
+    }
+    else if (strcmp(argv[i], "-codegen-stats") == 0)
+    {
+      options.codegenStats = true;
+    }
+    else if (strcmp(argv[i], "-ftime-report") == 0)
+    {
+      options.timeReport = true;
+    }
+    else if (strcmp(argv[i], "-opt-stats=json") == 0)
+    {
+      options.optStats = true;
+      options.optStatsJson = true;
+    }
+    else if (argv[i][0] != '-')
+    {
+      filenames.push_back(argv[i]);
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+
+  if (filenames.empty())
+  {
+    usage();
+    exit(1);
+  }
+  if (llvmOptLevel != nullptr)
+  {
+    options.pipeline.push_back(std::string("llvm-") + llvmOptLevel);
+  }
+  EmitKind &emitKind = options.emitKind;
+  if (emitKind == EMIT_DEFAULT)
+  {
+    if (outputFile.empty() || endsWith(outputFile, ".ll"))
+    {
+      emitKind = EMIT_IR;
+    }
+    else if (endsWith(outputFile, ".bc"))
+    {
+      emitKind = EMIT_BITCODE;
+    }
+    else if (endsWith(outputFile, ".o"))
+    {
+      emitKind = EMIT_OBJECT;
+    }
+    else
+    {
+      emitKind = EMIT_EXECUTABLE;
+    }
+  }
+  if ((emitKind == EMIT_RUN || emitKind == EMIT_NONE) && !outputFile.empty())
+  {
+    std::cerr << "cc: -o can't be combined with --run / --emit=none" << std::endl;
+    exit(1);
+  }
+  bool multipleUnits = filenames.size() > 1;
+  if (emitKind == EMIT_OBJECT && multipleUnits && !outputFile.empty())
+  {
+    std::cerr << "cc: -o can't be combined with -c and several input files" << std::endl;
+    exit(1);
+  }
+  // the ast dump of -v is only readable one unit at a time, and the process wide numbers
+  // of -ftime-report are only meaningful for one unit at a time
+  if (options.verbose || options.timeReport)
+  {
+    workers = 1;
+  }
+  if (options.timeReport)
+  {
+    enableAllocationCounting();
+  }
+
+  // where every unit writes its output, units without a file hand their module back to main
+  bool linkUnits = multipleUnits && !outputFile.empty() && (emitKind == EMIT_IR || emitKind == EMIT_BITCODE);
+  std::vector<CompileJob> jobs(filenames.size());
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    auto &job = jobs[i];
+    job.filename = filenames[i];
+    if (!multipleUnits && !outputFile.empty() && emitKind != EMIT_EXECUTABLE)
+    {
+      job.outputFile = outputFile;
+    }
+    else if (emitKind == EMIT_EXECUTABLE)
+    {
+      SmallString<128> objectFile;
+      if (sys::fs::createTemporaryFile("cc", "o", objectFile))
+      {
+        std::cerr << "cc: could not create a temporary object file" << std::endl;
+        return 1;
+      }
+      job.outputFile = objectFile.str().str();
+    }
+    else if (emitKind == EMIT_IR && multipleUnits && !linkUnits)
+    {
+      job.outputFile = outputBase(job.filename) + ".ll";
+    }
+    else if (emitKind == EMIT_BITCODE && !linkUnits)
+    {
+      job.outputFile = outputBase(job.filename) + ".bc";
+    }
+    else if (emitKind == EMIT_OBJECT)
+    {
+      job.outputFile = outputBase(job.filename) + ".o";
+    }
+  }
+
+  compileAll(jobs, options, workers);
+
+  int status = 0;
+  bool complete = true;
+  for (auto &job : jobs)
+  {
+    if (multipleUnits && job.report.tellp() > 0)
+    {
+      std::cerr << "===--- " << job.filename << " ---===" << std::endl;
+    }
+    std::cerr << job.report.str();
+    if (options.timeReport)
+    {
+      printTimeReport(job, std::cerr);
+    }
+    if (job.status != 0)
+    {
+      status = job.status;
+    }
+    complete = complete && job.module != nullptr;
+  }
+  if (status != 0 || !complete)
+  {
+    if (emitKind == EMIT_EXECUTABLE)
+    {
+      for (auto &job : jobs)
+      {
+        sys::fs::remove(job.outputFile);
+      }
+    }
+    return status;
+  }
+
+  std::string error;
+  bool ok = true;
+  switch (emitKind)
+  {
+  case EMIT_RUN:
+  {
+    std::vector<orc::ThreadSafeModule> modules;
+    for (auto &job : jobs)
+    {
+      modules.push_back(orc::ThreadSafeModule(std::move(job.module), std::move(job.context)));
+    }
+    int exitCode;
+    if (!runMain(std::move(modules), filenames.front(), exitCode, error))
+    {
+      std::cerr << "cc: " << error << std::endl;
+      return 1;
+    }
+    return exitCode;
+  }
+  case EMIT_IR:
+  case EMIT_BITCODE:
+  {
+    if (jobs.front().outputFile.empty() && !linkUnits)
+    {
+      // a single unit without -o goes to stdout
+      jobs.front().module->print(outs(), nullptr);
+      break;
+    }
+    if (!linkUnits)
+    {
+      break;
+    }
+    std::vector<Module *> modules;
+    for (auto &job : jobs)
+    {
+      modules.push_back(job.module.get());
+    }
+    LLVMContext context;
+    auto linked = linkModules(modules, context, error);
+    ok = linked != nullptr && (emitKind == EMIT_IR ? emitIRFile(linked.get(), outputFile, error)
+                                                   : emitBitcodeFile(linked.get(), outputFile, error));
+    break;
+  }
+  case EMIT_EXECUTABLE:
+  {
+    std::vector<std::string> objectFiles;
+    for (auto &job : jobs)
+    {
+      objectFiles.push_back(job.outputFile);
+    }
+    ok = linkExecutable(objectFiles, outputFile.empty() ? "a.out" : outputFile, error);
+    for (auto &objectFile : objectFiles)
+    {
+      sys::fs::remove(objectFile);
+    }
+    break;
+  }
+  case EMIT_DEFAULT: // resolved from -o above
+  case EMIT_OBJECT:  // written by the workers
+  case EMIT_NONE:
+    break;
+  }
+  if (!ok)
+  {
+    std::cerr << "cc: " << error << std::endl;
+    return 1;
+  }
   return 0;
 }
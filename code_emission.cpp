@@ -0,0 +1,296 @@
+#include "code_emission.h"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+// registers the host target once per process, translation units may ask for their
+// target machines from several threads at the same time
+static void initializeHostTarget()
+{
+    static bool initialized = (InitializeNativeTarget(), InitializeNativeTargetAsmPrinter(), true);
+    (void)initialized;
+}
+
+std::unique_ptr<TargetMachine> createHostTargetMachine(std::string &error)
+{
+    initializeHostTarget();
+
+    auto triple = sys::getDefaultTargetTriple();
+    auto target = TargetRegistry::lookupTarget(triple, error);
+    if (target == nullptr)
+    {
+        return nullptr;
+    }
+
+    TargetOptions options;
+    // the system linker produces position independent executables by default
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(triple, sys::getHostCPUName(), "", options,
+                                                                      Reloc::PIC_));
+}
+
+void setModuleTarget(Module *module, TargetMachine *targetMachine)
+{
+    module->setTargetTriple(targetMachine->getTargetTriple().str());
+    module->setDataLayout(targetMachine->createDataLayout());
+}
+
+bool emitIRFile(Module *module, const std::string &path, std::string &error)
+{
+    std::error_code errorCode;
+    raw_fd_ostream out(path, errorCode, sys::fs::OF_Text);
+    if (errorCode)
+    {
+        error = "could not open " + path + ": " + errorCode.message();
+        return false;
+    }
+    module->print(out, nullptr);
+    return true;
+}
+
+bool emitBitcodeFile(Module *module, const std::string &path, std::string &error)
+{
+    std::error_code errorCode;
+    raw_fd_ostream out(path, errorCode, sys::fs::OF_None);
+    if (errorCode)
+    {
+        error = "could not open " + path + ": " + errorCode.message();
+        return false;
+    }
+    WriteBitcodeToFile(*module, out);
+    return true;
+}
+
+bool emitObjectFile(Module *module, TargetMachine *targetMachine, const std::string &path, std::string &error)
+{
+    std::error_code errorCode;
+    raw_fd_ostream out(path, errorCode, sys::fs::OF_None);
+    if (errorCode)
+    {
+        error = "could not open " + path + ": " + errorCode.message();
+        return false;
+    }
+
+    // codegen still runs on the legacy pass manager in llvm 14
+    legacy::PassManager passManager;
+    if (targetMachine->addPassesToEmitFile(passManager, out, nullptr, CGFT_ObjectFile))
+    {
+        error = "the target can't emit object files";
+        return false;
+    }
+    passManager.run(*module);
+    out.flush();
+    return true;
+}
+
+// the driver used when CC_LINKER isn't set, `make LINK_DRIVER=clang` changes it
+#ifndef LINK_DRIVER
+#define LINK_DRIVER "cc"
+#endif
+
+// Finds the system compiler driver to link with: $CC_LINKER if set, else LINK_DRIVER searched
+// directory by directory along PATH. This compiler is called cc as well, so a driver that
+// turns out to be the running executable (installed or first on PATH) is skipped.
+static bool findLinkDriver(std::string &driver, std::string &error)
+{
+    auto self = sys::fs::getMainExecutable(nullptr, (void *)&findLinkDriver);
+    auto isSelf = [&](const std::string &path)
+    {
+        return !self.empty() && sys::fs::equivalent(path, self);
+    };
+
+    const char *linker = getenv("CC_LINKER");
+    if (linker != nullptr && *linker != 0)
+    {
+        auto found = sys::findProgramByName(linker);
+        if (!found)
+        {
+            error = std::string("CC_LINKER: ") + linker + " not found";
+            return false;
+        }
+        if (isSelf(*found))
+        {
+            error = std::string("CC_LINKER: ") + linker + " is this compiler, not a system driver";
+            return false;
+        }
+        driver = *found;
+        return true;
+    }
+
+    SmallVector<StringRef, 16> paths;
+    if (const char *path = getenv("PATH"))
+    {
+        StringRef(path).split(paths, sys::EnvPathSeparator, -1, false);
+    }
+    for (auto directory : paths)
+    {
+        auto found = sys::findProgramByName(LINK_DRIVER, {directory});
+        if (found && !isSelf(*found))
+        {
+            driver = *found;
+            return true;
+        }
+    }
+    error = "no system compiler driver (" LINK_DRIVER ") found to link with, set CC_LINKER";
+    return false;
+}
+
+bool linkExecutable(const std::vector<std::string> &objects, const std::string &output, std::string &error)
+{
+    std::string driver;
+    if (!findLinkDriver(driver, error))
+    {
+        return false;
+    }
+
+    std::vector<StringRef> args = {driver};
+    for (auto &object : objects)
+    {
+        args.push_back(object);
+    }
+    args.push_back("-o");
+    args.push_back(output);
+    args.push_back("-lm");
+
+    if (sys::ExecuteAndWait(driver, args, None, {}, 0, 0, &error) != 0)
+    {
+        if (error.empty())
+        {
+            error = "linking " + output + " failed";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool moveFunctionBodies(Module *module, StringRef bitcode, std::string &error)
+{
+    auto part = parseBitcodeFile(MemoryBufferRef(bitcode, module->getModuleIdentifier()), module->getContext());
+    if (!part)
+    {
+        error = toString(part.takeError());
+        return false;
+    }
+
+    // bitcode keeps the order of the globals, so they are matched up by position
+    std::vector<GlobalValue *> partValues, values;
+    for (auto &global : (*part)->global_values())
+    {
+        partValues.push_back(&global);
+    }
+    for (auto &global : module->global_values())
+    {
+        values.push_back(&global);
+    }
+    if (partValues.size() != values.size())
+    {
+        error = "the copy of module " + module->getModuleIdentifier() + " has different globals";
+        return false;
+    }
+
+    for (size_t i = 0; i < partValues.size(); i++)
+    {
+        auto partFunction = dyn_cast<Function>(partValues[i]);
+        if (partFunction == nullptr || partFunction->isDeclaration())
+        {
+            continue;
+        }
+        auto function = cast<Function>(values[i]);
+        function->dropAllReferences();
+        function->getBasicBlockList().splice(function->end(), partFunction->getBasicBlockList());
+        for (unsigned arg = 0; arg < function->arg_size(); arg++)
+        {
+            partFunction->getArg(arg)->replaceAllUsesWith(function->getArg(arg));
+        }
+    }
+    // the moved bodies still refer to the globals of the copy
+    for (size_t i = 0; i < partValues.size(); i++)
+    {
+        partValues[i]->replaceAllUsesWith(values[i]);
+    }
+    return true;
+}
+
+std::unique_ptr<Module> linkModules(const std::vector<Module *> &modules, LLVMContext &context, std::string &error)
+{
+    auto linked = std::make_unique<Module>(modules.front()->getModuleIdentifier(), context);
+    Linker linker(*linked);
+    for (auto module : modules)
+    {
+        SmallVector<char, 0> buffer;
+        raw_svector_ostream out(buffer);
+        WriteBitcodeToFile(*module, out);
+        auto copy = parseBitcodeFile(MemoryBufferRef(StringRef(buffer.data(), buffer.size()),
+                                                     module->getModuleIdentifier()),
+                                     context);
+        if (!copy)
+        {
+            error = toString(copy.takeError());
+            return nullptr;
+        }
+        // true means failure, the reason was already printed by the linker
+        if (linker.linkInModule(std::move(*copy)))
+        {
+            error = "linking the translation units failed";
+            return nullptr;
+        }
+    }
+    return linked;
+}
+
+bool runMain(std::vector<orc::ThreadSafeModule> modules, const char *programName, int &exitCode,
+             std::string &error)
+{
+    initializeHostTarget();
+
+    auto jit = orc::LLLazyJITBuilder().create();
+    if (!jit)
+    {
+        error = toString(jit.takeError());
+        return false;
+    }
+    // one partition per function instead of the whole module at the first call
+    (*jit)->setPartitionFunction(orc::CompileOnDemandLayer::compileRequested);
+
+    // calls into libc (printf, ...) resolve to the symbols of this process
+    auto &mainDylib = (*jit)->getMainJITDylib();
+    auto processSymbols = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        (*jit)->getDataLayout().getGlobalPrefix());
+    if (!processSymbols)
+    {
+        error = toString(processSymbols.takeError());
+        return false;
+    }
+    mainDylib.addGenerator(std::move(*processSymbols));
+
+    for (auto &module : modules)
+    {
+        if (auto err = (*jit)->addLazyIRModule(std::move(module)))
+        {
+            error = toString(std::move(err));
+            return false;
+        }
+    }
+
+    auto mainSymbol = (*jit)->lookup("main");
+    if (!mainSymbol)
+    {
+        error = toString(mainSymbol.takeError());
+        return false;
+    }
+
+    // main may be declared without parameters, passing argc/argv anyway is fine in the c abi
+    auto mainFunction = jitTargetAddressToFunction<int (*)(int, char **)>(mainSymbol->getAddress());
+    char *argv[] = {const_cast<char *>(programName), nullptr};
+    exitCode = mainFunction(1, argv);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef CODE_EMISSION_H
+#define CODE_EMISSION_H
+
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+// target machine for the host, returns nullptr (with a message in `error`) if the
+// host target isn't available in this llvm build
+std::unique_ptr<TargetMachine> createHostTargetMachine(std::string &error);
+
+// sets the triple / data layout of the module to the ones of the target machine,
+// should happen before optimization so the passes see the real layout
+void setModuleTarget(Module *module, TargetMachine *targetMachine);
+
+// writes the module as textual llvm ir
+bool emitIRFile(Module *module, const std::string &path, std::string &error);
+
+// writes the module as llvm bitcode, much cheaper to write and read back than text
+bool emitBitcodeFile(Module *module, const std::string &path, std::string &error);
+
+// writes the module as a native object file
+bool emitObjectFile(Module *module, TargetMachine *targetMachine, const std::string &path, std::string &error);
+
+// links object files into an executable by running the system compiler driver ($CC_LINKER or
+// cc, never this compiler itself)
+bool linkExecutable(const std::vector<std::string> &objects, const std::string &output, std::string &error);
+
+// Moves the function bodies of a copy of `module`, serialized as bitcode (e.g. by another
+// thread working in its own context), back into the functions of `module`. The copy must
+// have the same globals and functions in the same order; only functions with a body in
+// the copy are replaced, the others are left alone.
+bool moveFunctionBodies(Module *module, StringRef bitcode, std::string &error);
+
+// links modules of different contexts into one new module in `context` (like llvm-link),
+// the modules are moved over through bitcode since llvm can't link across contexts
+std::unique_ptr<Module> linkModules(const std::vector<Module *> &modules, LLVMContext &context, std::string &error);
+
+// compiles the modules (one per translation unit, each with its own context) with the
+// orc lazy jit and calls main, functions are only compiled the first time they are called
+bool runMain(std::vector<orc::ThreadSafeModule> modules, const char *programName, int &exitCode,
+             std::string &error);
+
+#endif
@@ -1,420 +1,3138 @@
 #include "code_optimization.h"
+#include "code_emission.h"
+#include "work_queue.h"
 
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 // mem2reg includes dead code removal
-static bool mem2reg(CodeOptContext *codeOptContext);
-static bool constantFolding(CodeOptContext *codeOptContext);
+static bool mem2reg(Function *function, CodeOptContext *codeOptContext);
+static bool constantFolding(Function *function, CodeOptContext *codeOptContext);
+static bool gvn(Function *function, CodeOptContext *codeOptContext);
+static bool licm(Function *function, CodeOptContext *codeOptContext);
+static bool indvars(Function *function, CodeOptContext *codeOptContext);
+static bool unroll(Function *function, CodeOptContext *codeOptContext);
+static bool inlineFunctions(CodeOptContext *codeOptContext);
+static bool llvmO1(CodeOptContext *codeOptContext);
+static bool llvmO2(CodeOptContext *codeOptContext);
+static bool llvmO3(CodeOptContext *codeOptContext);
 
-void optimize(CodeOptContext *codeOptContext)
+struct OptPass
 {
+    const char *name;
+    // passes that only ever look at one function set runOnFunction, optimize() runs them
+    // function by function and, with codeOptContext->threads > 1, on several threads
+    bool (*runOnFunction)(Function *function, CodeOptContext *codeOptContext);
+    bool (*runOnModule)(CodeOptContext *codeOptContext);
+};
 
-    mem2reg(codeOptContext);
-    constantFolding(codeOptContext);
-}
+// every pass that can be named in -passes=
+static const OptPass registeredPasses[] = {
+    {"mem2reg", mem2reg, nullptr},
+    {"constfold", constantFolding, nullptr},
+    {"gvn", gvn, nullptr},
+    {"licm", licm, nullptr},
+    {"indvars", indvars, nullptr},
+    {"unroll", unroll, nullptr},
+    // needs the whole call graph, runs on the module
+    {"inline", nullptr, inlineFunctions},
+    // LLVM's own default pipelines, run in-process on top of ours (-O1/-O2/-O3)
+    {"llvm-O1", nullptr, llvmO1},
+    {"llvm-O2", nullptr, llvmO2},
+    {"llvm-O3", nullptr, llvmO3},
+};
+// held while an optimizer thread prints a diagnostic (and exits)
+static std::mutex printLock;
 
-static bool removeDeadStores(Function *function, CodeOptContext *codeOptContext)
+static const OptPass *findPass(const std::string &name)
 {
+    for (auto &pass : registeredPasses)
+    {
+        if (name == pass.name)
+        {
+            return &pass;
+        }
+    }
+    return nullptr;
+}
 
-    bool changed = false;
-
-    std::vector<std::pair<AllocaInst *, std::vector<Instruction *>>> allocaInstructions;
-
-    for (auto bb = function->begin(); bb != function->end(); bb++)
+bool parsePipeline(const std::string &spec, std::vector<std::string> &pipeline, std::string &error)
+{
+    pipeline.clear();
+    size_t start = 0;
+    while (start < spec.size())
     {
-        for (auto instr = bb->begin(); instr != bb->end(); instr++)
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = spec.size();
+        }
+        std::string name = spec.substr(start, end - start);
+        if (findPass(name) == nullptr)
         {
-            if (isa<AllocaInst>(instr))
+            error = "unknown pass '" + name + "', available passes:";
+            for (auto &pass : registeredPasses)
             {
-                auto alloca = dyn_cast<AllocaInst>(instr);
-                allocaInstructions.push_back(std::make_pair(alloca, std::vector<Instruction *>()));
+                error += std::string(" ") + pass.name;
             }
+            return false;
         }
+        pipeline.push_back(name);
+        start = end + 1;
     }
+    return true;
+}
 
-    std::vector<AllocaInst *> usefulAllocaInstructions;
+long countInstructions(Module *module)
+{
+    long count = 0;
+    for (auto &function : *module)
+    {
+        count += function.getInstructionCount();
+    }
+    return count;
+}
 
-    for (auto instr : allocaInstructions)
+// runs the function passes on one function, recording into passStats[firstStat..]
+static void runFunctionPasses(Function *function, const std::vector<const OptPass *> &passes,
+                              CodeOptContext *codeOptContext, size_t firstStat)
+{
+    for (size_t i = 0; i < passes.size(); i++)
     {
+        codeOptContext->activePass = firstStat + i;
+        auto &stats = codeOptContext->passStats[firstStat + i];
+        stats.instructionsBefore += function->getInstructionCount();
+        auto start = std::chrono::steady_clock::now();
+        passes[i]->runOnFunction(function, codeOptContext);
+        auto end = std::chrono::steady_clock::now();
+        stats.wallSeconds += std::chrono::duration<double>(end - start).count();
+        stats.instructionsAfter += function->getInstructionCount();
+    }
+}
 
-        bool isUseful = false;
+// Runs consecutive function passes over the functions of the module on
+// codeOptContext->threads threads. An LLVMContext can't be used from several threads,
+// even for different functions (constants and globals keep a single use list), so every
+// thread lazily loads its own copy of the module from bitcode, into its own context,
+// and only materializes the functions it takes from the queues. The optimized bodies
+// come back the same way and are moved into the functions of the original module.
+static void runFunctionPassesInParallel(CodeOptContext *codeOptContext, const std::vector<const OptPass *> &passes)
+{
+    auto module = codeOptContext->module.get();
+    size_t firstStat = codeOptContext->passStats.size();
+    for (auto pass : passes)
+    {
+        codeOptContext->passStats.push_back(PassStats());
+        codeOptContext->passStats.back().name = pass->name;
+    }
 
-        for (auto bb = function->begin(); bb != function->end(); bb++)
+    std::vector<Function *> definitions;
+    for (auto &function : *module)
+    {
+        if (!function.isDeclaration())
         {
-            for (auto otherInstr = bb->begin(); otherInstr != bb->end(); otherInstr++)
-            {
+            definitions.push_back(&function);
+        }
+    }
+    unsigned threads = std::min<size_t>(codeOptContext->threads, definitions.size());
+    if (threads <= 1)
+    {
+        for (auto function : definitions)
+        {
+            runFunctionPasses(function, passes, codeOptContext, firstStat);
+        }
+        return;
+    }
 
-                if (isa<StoreInst>(otherInstr))
-                {
-                    auto store = dyn_cast<StoreInst>(otherInstr);
-                    if (store->getPointerOperand() == instr.first)
-                    {
-                        instr.second.push_back(store);
-                    }
-                }
-                else if (isa<LoadInst>(otherInstr))
-                {
-                    auto load = dyn_cast<LoadInst>(otherInstr);
-                    if (load->getPointerOperand() == instr.first)
-                    {
-                        instr.second.push_back(load);
-                        isUseful = true;
-                    }
-                }
+    SmallVector<char, 0> input;
+    raw_svector_ostream inputStream(input);
+    WriteBitcodeToFile(*module, inputStream);
+
+    WorkStealingQueues queues(definitions.size(), threads);
+    std::vector<SmallVector<char, 0>> outputs(threads);
+    std::vector<std::vector<PassStats>> threadStats(threads);
+    auto work = [&](unsigned thread)
+    {
+        CodeOptContext part(new LLVMContext(), nullptr, nullptr);
+        part.verifyEach = codeOptContext->verifyEach;
+        part.inlineThreshold = codeOptContext->inlineThreshold;
+        part.unrollThreshold = codeOptContext->unrollThreshold;
+        part.unrollCount = codeOptContext->unrollCount;
+        part.passStats.resize(passes.size());
+        auto loaded = getLazyBitcodeModule(MemoryBufferRef(StringRef(input.data(), input.size()), "opt-input"),
+                                           *part.context);
+        if (!loaded)
+        {
+            std::lock_guard<std::mutex> guard(printLock);
+            errs() << "[Code Opt] " << toString(loaded.takeError()) << "\n";
+            exit(1);
+        }
+        part.module = std::move(*loaded);
+
+        // same order as `definitions`, bitcode keeps the order of the functions
+        std::vector<Function *> partDefinitions;
+        for (auto &function : *part.module)
+        {
+            if (!function.isDeclaration())
+            {
+                partDefinitions.push_back(&function);
             }
         }
-        if (!isUseful)
+        std::vector<bool> taken(partDefinitions.size());
+        size_t item;
+        while (queues.pop(thread, item))
         {
-            for (auto i : instr.second)
+            auto function = partDefinitions[item];
+            if (auto err = function->materialize())
             {
-                i->eraseFromParent();
-                changed = true;
+                std::lock_guard<std::mutex> guard(printLock);
+                errs() << "[Code Opt] " << toString(std::move(err)) << "\n";
+                exit(1);
             }
-            instr.first->eraseFromParent();
+            runFunctionPasses(function, passes, &part, 0);
+            taken[item] = true;
         }
 
-        if (verifyFunction(*function, &errs()))
+        // only the bodies this thread optimized are sent back
+        for (size_t i = 0; i < partDefinitions.size(); i++)
         {
-            codeOptContext->module->print(errs(), nullptr);
-            std::cerr << "Compilation Failed... Aborting.." << std::endl;
-            exit(1);
-            return changed;
+            if (!taken[i])
+            {
+                partDefinitions[i]->deleteBody();
+            }
         }
-    }
-
-    return changed;
-}
+        cantFail(part.module->materializeAll());
+        raw_svector_ostream outputStream(outputs[thread]);
+        WriteBitcodeToFile(*part.module, outputStream);
+        threadStats[thread] = std::move(part.passStats);
+    };
 
-static bool removeDeadInstructions(Function *function, CodeOptContext *codeOptContext)
-{
+    std::vector<std::thread> workers;
+    for (unsigned thread = 0; thread < threads; thread++)
+    {
+        workers.emplace_back(work, thread);
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
 
-    bool changed = false;
-    for (auto bb = function->begin(); bb != function->end(); bb++)
+    for (unsigned thread = 0; thread < threads; thread++)
     {
-        auto instr = bb->begin();
-        while (instr != bb->end())
+        std::string error;
+        if (!moveFunctionBodies(module, StringRef(outputs[thread].data(), outputs[thread].size()), error))
+        {
+            std::cerr << "[Code Opt] " << error << std::endl;
+            exit(1);
+        }
+
+        for (size_t i = 0; i < passes.size(); i++)
         {
-            if (instr->isTerminator())
+            auto &stats = codeOptContext->passStats[firstStat + i];
+            auto &partStats = threadStats[thread][i];
+            stats.wallSeconds += partStats.wallSeconds;
+            stats.instructionsBefore += partStats.instructionsBefore;
+            stats.instructionsAfter += partStats.instructionsAfter;
+            stats.iterations += partStats.iterations;
+            for (auto &entry : partStats.removed)
             {
-                instr++;
-                continue;
+                stats.removed[entry.first] += entry.second;
             }
-            if (isa<StoreInst>(instr))
+            for (auto &entry : partStats.added)
             {
-                instr++;
-                continue;
+                stats.added[entry.first] += entry.second;
             }
-            if (isa<CallInst>(instr) || isa<InvokeInst>(instr))
+            for (auto &entry : partStats.events)
             {
-                instr++;
-                continue;
+                stats.events[entry.first] += entry.second;
             }
+        }
+    }
+}
 
-            if (instr->getNumUses() == 0)
+void optimize(CodeOptContext *codeOptContext)
+{
+    auto module = codeOptContext->module.get();
+    auto &pipeline = codeOptContext->pipeline;
+    for (size_t i = 0; i < pipeline.size();)
+    {
+        auto pass = findPass(pipeline[i]);
+        assert(pass != nullptr && "pipeline should have been checked by parsePipeline");
+
+        if (pass->runOnFunction != nullptr && codeOptContext->threads > 1)
+        {
+            // consecutive function passes run as one per-function pipeline
+            std::vector<const OptPass *> passes;
+            for (; i < pipeline.size() && findPass(pipeline[i])->runOnFunction != nullptr; i++)
             {
-                instr = instr->eraseFromParent();
-                changed = true;
+                passes.push_back(findPass(pipeline[i]));
             }
-            else
+            runFunctionPassesInParallel(codeOptContext, passes);
+            continue;
+        }
+
+        codeOptContext->passStats.push_back(PassStats());
+        codeOptContext->activePass = codeOptContext->passStats.size() - 1;
+        auto &stats = codeOptContext->passStats.back();
+        stats.name = pass->name;
+        stats.instructionsBefore = countInstructions(module);
+
+        auto start = std::chrono::steady_clock::now();
+        if (pass->runOnFunction != nullptr)
+        {
+            for (auto &function : *module)
             {
-                instr++;
+                pass->runOnFunction(&function, codeOptContext);
             }
         }
+        else
+        {
+            pass->runOnModule(codeOptContext);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        stats.wallSeconds = std::chrono::duration<double>(end - start).count();
+        stats.instructionsAfter = countInstructions(module);
+        i++;
+    }
+}
+
+static long sumOf(const std::map<std::string, long> &counts)
+{
+    long sum = 0;
+    for (auto &entry : counts)
+    {
+        sum += entry.second;
+    }
+    return sum;
+}
+
+static void printStatsText(CodeOptContext *codeOptContext, std::ostream &out)
+{
+    out << "===--- Optimizer pass statistics ---===" << std::endl;
+    out << std::left << std::setw(22) << "pass" << std::right
+        << std::setw(12) << "wall(ms)" << std::setw(10) << "before" << std::setw(10) << "after"
+        << std::setw(10) << "removed" << std::setw(10) << "added" << std::setw(12) << "iterations" << std::endl;
+    double total = 0;
+    for (auto &stats : codeOptContext->passStats)
+    {
+        total += stats.wallSeconds;
+        out << std::left << std::setw(22) << stats.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << stats.wallSeconds * 1000 << std::setw(10) << stats.instructionsBefore
+            << std::setw(10) << stats.instructionsAfter << std::setw(10) << sumOf(stats.removed)
+            << std::setw(10) << sumOf(stats.added) << std::setw(12) << stats.iterations << std::endl;
+
+        std::set<std::string> subPasses;
+        for (auto &entry : stats.removed)
+        {
+            subPasses.insert(entry.first);
+        }
+        for (auto &entry : stats.added)
+        {
+            subPasses.insert(entry.first);
+        }
+        for (auto &subPass : subPasses)
+        {
+            auto removed = stats.removed.find(subPass);
+            auto added = stats.added.find(subPass);
+            out << std::left << std::setw(22) << "  " + subPass << std::right << std::setw(32) << ""
+                << std::setw(10) << (removed == stats.removed.end() ? 0 : removed->second)
+                << std::setw(10) << (added == stats.added.end() ? 0 : added->second) << std::endl;
+        }
+        for (auto &entry : stats.events)
+        {
+            out << "  " << entry.first << ": " << entry.second << std::endl;
+        }
+    }
+    out << std::left << std::setw(22) << "total" << std::right << std::setw(12) << total * 1000 << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
+
+static void printCountsJson(const std::map<std::string, long> &counts, std::ostream &out)
+{
+    out << "{";
+    bool first = true;
+    for (auto &entry : counts)
+    {
+        out << (first ? "" : ", ") << "\"" << entry.first << "\": " << entry.second;
+        first = false;
+    }
+    out << "}";
+}
+
+static void printStatsJson(CodeOptContext *codeOptContext, std::ostream &out)
+{
+    double total = 0;
+    out << "{\"passes\": [";
+    bool first = true;
+    for (auto &stats : codeOptContext->passStats)
+    {
+        total += stats.wallSeconds;
+        out << (first ? "" : ", ") << "{\"name\": \"" << stats.name << "\""
+            << ", \"wall_ms\": " << stats.wallSeconds * 1000
+            << ", \"instructions_before\": " << stats.instructionsBefore
+            << ", \"instructions_after\": " << stats.instructionsAfter
+            << ", \"removed\": " << sumOf(stats.removed)
+            << ", \"added\": " << sumOf(stats.added)
+            << ", \"iterations\": " << stats.iterations
+            << ", \"removed_by\": ";
+        printCountsJson(stats.removed, out);
+        out << ", \"added_by\": ";
+        printCountsJson(stats.added, out);
+        out << ", \"events\": ";
+        printCountsJson(stats.events, out);
+        out << "}";
+        first = false;
+    }
+    out << "], \"total_wall_ms\": " << total * 1000 << "}" << std::endl;
+}
+
+void printOptStats(CodeOptContext *codeOptContext, std::ostream &out, bool json)
+{
+    if (json)
+    {
+        printStatsJson(codeOptContext, out);
+    }
+    else
+    {
+        printStatsText(codeOptContext, out);
     }
+}
+
+// counters of the pass that is currently run by optimize()
+static PassStats &currentPass(CodeOptContext *codeOptContext)
+{
+    return codeOptContext->passStats[codeOptContext->activePass];
+}
+
+// removePredecessor() may fold away phis that are left with a single value, count those too
+static long removePredecessor(BasicBlock *bb, BasicBlock *pred)
+{
+    long phisBefore = std::distance(bb->phis().begin(), bb->phis().end());
+    bb->removePredecessor(pred);
+    return phisBefore - std::distance(bb->phis().begin(), bb->phis().end());
+}
 
+// Sub-passes only verify their result in --verify-each mode (for debugging the optimizer),
+// otherwise the driver verifies the whole module once after optimize().
+static void verifyAfterPass(Function *function, CodeOptContext *codeOptContext, const char *passName)
+{
+    if (!codeOptContext->verifyEach)
+    {
+        return;
+    }
     if (verifyFunction(*function, &errs()))
     {
+        // other threads may be optimizing functions too, the lock keeps the output in one
+        // piece until exit. The module is the copy this thread works on (own context).
+        std::lock_guard<std::mutex> guard(printLock);
+        std::cerr << "[Code Opt] " << passName << " broke function " << function->getName().str() << std::endl;
         codeOptContext->module->print(errs(), nullptr);
         std::cerr << "Compilation Failed... Aborting.." << std::endl;
         exit(1);
-        return changed;
     }
-    return changed;
 }
 
-static bool promoteAllocas(Function *function, CodeOptContext *codeOptContext)
+// an instruction is dead if nothing uses its result and it has no side effects
+static bool isDeadInstruction(Instruction *instr)
 {
+    if (instr->isTerminator() || isa<StoreInst>(instr) || isa<CallInst>(instr) || isa<InvokeInst>(instr))
+    {
+        return false;
+    }
+    return instr->use_empty();
+}
 
-    bool changed = false;
-
-    std::vector<AllocaInst *> allocaInstructions;
+// Removes allocas that are never loaded from, together with all the stores into them.
+// Each alloca is checked through its own use list, so the cost is linear in the number
+// of allocas + their uses instead of allocas x instructions.
+// Removing a store can make other allocas dead (e.g. when the stored value was the address
+// of another alloca), those are put back on the worklist.
+static bool removeDeadStores(Function *function, CodeOptContext *codeOptContext)
+{
+    long removed = 0;
 
-    for (auto bb = function->begin(); bb != function->end(); bb++)
+    std::vector<AllocaInst *> worklist;
+    for (auto &bb : *function)
     {
-        for (auto instr = bb->begin(); instr != bb->end(); instr++)
+        for (auto &instr : bb)
         {
-            if (isa<AllocaInst>(instr))
+            if (auto alloca = dyn_cast<AllocaInst>(&instr))
             {
-                auto alloca = dyn_cast<AllocaInst>(instr);
-                allocaInstructions.push_back(alloca);
+                worklist.push_back(alloca);
             }
         }
     }
 
-    for (auto alloca : allocaInstructions)
+    std::set<AllocaInst *> erased;
+    while (!worklist.empty())
     {
+        auto alloca = worklist.back();
+        worklist.pop_back();
+        if (erased.count(alloca))
+        {
+            continue;
+        }
 
-        auto DT = DominatorTree(*function);
-
-        std::vector<LoadInst *> loadUses;
-        std::vector<StoreInst *> storeUses;
+        bool isUseful = false;
         for (auto user : alloca->users())
         {
-            if (isa<LoadInst>(user))
-            {
-                loadUses.push_back(dyn_cast<LoadInst>(user));
-            }
-            else if (isa<StoreInst>(user))
+            auto store = dyn_cast<StoreInst>(user);
+            if (store == nullptr || store->getPointerOperand() != alloca || store->getValueOperand() == alloca)
             {
-                storeUses.push_back(dyn_cast<StoreInst>(user));
+                isUseful = true;
+                break;
             }
         }
-
-        // std::cout << "Alloca: " << alloca->getName().str() << " " << storeUses.size() << " " << loadUses.size() << std::endl;
-
-        if (storeUses.size() == 0 || loadUses.size() == 0)
+        if (isUseful)
         {
             continue;
         }
 
-        if (storeUses.size() == 1)
+        while (!alloca->use_empty())
         {
-            // if only one store usage, replace the all the loads **after the store** with the store value
-            // note that in cases like
-            // int x; y = x; x = 5;,  there is only one store, but y takes the un-stored value of x
-
-            auto store = storeUses[0];
-
-            auto storeBB = store->getParent();
-            bool someLoadBeforeStore = false;
-            for (auto load : loadUses)
-            {
-                auto loadBB = load->getParent();
-
-                // if loadBB is in same bb as store
-                if (loadBB == storeBB)
-                {
-                    // if load is after store
-                    if (DT.dominates(store, load))
-                    {
-                        load->replaceAllUsesWith(store->getValueOperand());
-                        load->eraseFromParent();
-                        changed = true;
-                    }
-                    else
-                    {
-                        // if load is before store
-                        // do nothing
-                        someLoadBeforeStore = true;
-                    }
-                }
-                else
-                {
-                    // if loadBB is after storeBB
-                    if (DT.dominates(storeBB, loadBB))
-                    {
-                        load->replaceAllUsesWith(store->getValueOperand());
-                        load->eraseFromParent();
-                        changed = true;
-                    }
-                    else
-                    {
-                        // if loadBB is before storeBB
-                        // do nothing
-                        someLoadBeforeStore = true;
-                    }
-                }
-            }
-            if (!someLoadBeforeStore)
+            auto store = cast<StoreInst>(alloca->user_back());
+            auto storedAlloca = dyn_cast<AllocaInst>(store->getValueOperand());
+            store->eraseFromParent();
+            removed++;
+            if (storedAlloca != nullptr)
             {
-                store->eraseFromParent();
-                alloca->eraseFromParent();
-                changed = true;
+                worklist.push_back(storedAlloca);
             }
-            // function->print(errs(), nullptr);
-            continue;
         }
+        alloca->eraseFromParent();
+        erased.insert(alloca);
+        removed++;
+    }
+
+    currentPass(codeOptContext).removed["dead-stores"] += removed;
+
+    verifyAfterPass(function, codeOptContext, "dead-stores");
+    return removed > 0;
+}
 
-        bool allLoadStoresInSameBB = true;
-        assert(storeUses.size() > 1);
+// Removes instructions without uses. Operands of an erased instruction are revisited
+// right away, so whole dead expression trees go in a single call.
+static bool removeDeadInstructions(Function *function, CodeOptContext *codeOptContext)
+{
+    long removed = 0;
 
-        auto firstStoreBB = storeUses[0]->getParent();
-        for (auto load : loadUses)
+    std::vector<Instruction *> worklist;
+    for (auto &bb : *function)
+    {
+        for (auto &instr : bb)
         {
-            if (load->getParent() != firstStoreBB)
+            if (isDeadInstruction(&instr))
             {
-                allLoadStoresInSameBB = false;
-                break;
+                worklist.push_back(&instr);
             }
         }
+    }
 
-        for (auto store : storeUses)
+    std::set<Instruction *> erased;
+    while (!worklist.empty())
+    {
+        auto instr = worklist.back();
+        worklist.pop_back();
+        if (erased.count(instr) || !isDeadInstruction(instr))
         {
-            if (store->getParent() != firstStoreBB)
-            {
-                allLoadStoresInSameBB = false;
-                break;
-            }
+            continue;
         }
-
-        // all load stores in same bb
-        if (allLoadStoresInSameBB)
+        for (auto &operand : instr->operands())
         {
-            StoreInst *prevStore = nullptr;
-            auto instr = firstStoreBB->begin();
-            while (instr != firstStoreBB->end())
+            if (auto operandInstr = dyn_cast<Instruction>(operand.get()))
             {
-                if (isa<StoreInst>(instr))
-                {
-                    auto store = dyn_cast<StoreInst>(instr);
-                    if (store->getPointerOperand() == alloca)
-                    {
-                        prevStore = store;
-                    }
-                }
-                if (isa<LoadInst>(instr))
+                if (operandInstr != instr)
                 {
-                    auto load = dyn_cast<LoadInst>(instr);
-                    if (load->getPointerOperand() == alloca)
-                    {
-                        if (prevStore != nullptr)
-                        {
-                            load->replaceAllUsesWith(prevStore->getValueOperand());
-                            instr = instr->eraseFromParent();
-                            continue;
-                            changed = true;
-                        }
-                    }
+                    worklist.push_back(operandInstr);
                 }
-                instr++;
             }
         }
+        instr->eraseFromParent();
+        erased.insert(instr);
+        removed++;
     }
 
-    if (verifyFunction(*function, &errs()))
-    {
-        codeOptContext->module->print(errs(), nullptr);
-        std::cerr << "Compilation Failed... Aborting.." << std::endl;
-        exit(1);
-        return changed;
-    }
-    return changed;
+    currentPass(codeOptContext).removed["dead-instructions"] += removed;
+
+    verifyAfterPass(function, codeOptContext, "dead-instructions");
+    return removed > 0;
 }
 
-static bool mem2reg(CodeOptContext *codeOptContext)
+// an alloca can be promoted to ssa registers if its address never escapes,
+// i.e. it is only used as the pointer operand of loads and stores
+static bool isPromotable(AllocaInst *alloca)
 {
-    auto module = codeOptContext->module.get();
-    auto functions = module->functions();
-    bool ret = false;
-    for (auto it = functions.begin(); it != functions.end(); it++)
+    if (alloca->isArrayAllocation())
+    {
+        return false;
+    }
+    auto allocatedType = alloca->getAllocatedType();
+    for (auto user : alloca->users())
     {
-        auto function = &*it;
-        while (true)
+        if (auto load = dyn_cast<LoadInst>(user))
         {
-            bool changed = promoteAllocas(function, codeOptContext);
-            changed = changed || removeDeadStores(function, codeOptContext);
-            changed = changed || removeDeadInstructions(function, codeOptContext);
-            if (!changed)
+            if (load->isVolatile() || load->getType() != allocatedType)
             {
-                break;
+                return false;
             }
-            else
+        }
+        else if (auto store = dyn_cast<StoreInst>(user))
+        {
+            if (store->isVolatile() || store->getValueOperand() == alloca ||
+                store->getValueOperand()->getType() != allocatedType)
             {
-                ret = true;
+                return false;
             }
         }
+        else
+        {
+            return false;
+        }
     }
-    return ret;
+    return true;
 }
 
-static bool propagateConstants(Function *function, CodeOptContext *codeOptContext)
+// dominance frontiers using the algorithm from Cooper, Harvey & Kennedy,
+// "A Simple, Fast Dominance Algorithm": walk up from every predecessor of a
+// join point until we hit the join point's immediate dominator.
+static std::unordered_map<BasicBlock *, std::vector<BasicBlock *>> computeDominanceFrontiers(Function *function,
+                                                                                            DominatorTree &DT)
 {
-    bool changed = false;
-    for (auto bb = function->begin(); bb != function->end(); bb++)
+    std::unordered_map<BasicBlock *, std::vector<BasicBlock *>> frontiers;
+    for (auto &bb : *function)
     {
-        for (auto instr = bb->begin(); instr != bb->end(); instr++)
+        if (!DT.isReachableFromEntry(&bb) || !bb.hasNPredecessorsOrMore(2))
         {
-            if (isa<BinaryOperator>(instr))
+            continue;
+        }
+        auto idom = DT.getNode(&bb)->getIDom();
+        for (auto pred : predecessors(&bb))
+        {
+            if (!DT.isReachableFromEntry(pred))
+            {
+                continue;
+            }
+            auto runner = DT.getNode(pred);
+            while (runner != idom)
             {
-                auto binOp = dyn_cast<BinaryOperator>(instr);
-                if (isa<ConstantInt>(binOp->getOperand(0)) && isa<ConstantInt>(binOp->getOperand(1)))
+                auto &frontier = frontiers[runner->getBlock()];
+                if (frontier.empty() || frontier.back() != &bb)
                 {
-                    auto op0 = dyn_cast<ConstantInt>(binOp->getOperand(0));
-                    auto op1 = dyn_cast<ConstantInt>(binOp->getOperand(1));
-                    auto result = ConstantInt::get(op0->getType(), 0);
-                    switch (binOp->getOpcode())
-                    {
-                    case Instruction::Add:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() + op1->getSExtValue());
-                        break;
-                    case Instruction::Sub:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() - op1->getSExtValue());
-                        break;
-                    case Instruction::Mul:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() * op1->getSExtValue());
-                        break;
-                    case Instruction::SDiv:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() / op1->getSExtValue());
-                        break;
-                    case Instruction::SRem:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() % op1->getSExtValue());
-                        break;
-                    case Instruction::And:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() & op1->getSExtValue());
-                        break;
-                    case Instruction::Or:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() | op1->getSExtValue());
-                        break;
-                    case Instruction::Xor:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() ^ op1->getSExtValue());
-                        break;
-                    case Instruction::Shl:
-                        result = ConstantInt::get(op0->getType(), op0->getSExtValue() << op1->getSExtValue());
-                        break;
-                    default:
-                        assert(false && "Unimplemented op code");
-                        break;
-                    }
-
-                    binOp->replaceAllUsesWith(result);
-                    instr->eraseFromParent();
-                    changed = true;
-                    break;
+                    frontier.push_back(&bb);
                 }
+                runner = runner->getIDom();
             }
         }
     }
-    if (verifyFunction(*function, &errs()))
-    {
-        codeOptContext->module->print(errs(), nullptr);
-        std::cerr << "Compilation Failed... Aborting.." << std::endl;
-        exit(1);
-        return changed;
-    }
-    return changed;
+    return frontiers;
 }
 
-static bool constantFolding(CodeOptContext *codeOptContext)
+// blocks in which the first access to an alloca is a load, for every alloca.
+// A single walk over the function notes the first access of each alloca per block,
+// so a big entry block holding many locals is scanned once, not once per alloca.
+static std::vector<std::vector<BasicBlock *>> computeUpwardExposedBlocks(
+    Function *function, const std::unordered_map<AllocaInst *, unsigned> &allocaIndex)
 {
-    auto module = codeOptContext->module.get();
-    auto functions = module->functions();
-    bool ret = false;
-    for (auto it = functions.begin(); it != functions.end(); it++)
+    std::vector<std::vector<BasicBlock *>> exposed(allocaIndex.size());
+    std::vector<BasicBlock *> lastSeen(allocaIndex.size(), nullptr);
+    for (auto &bb : *function)
     {
-        auto function = &*it;
-        while (true)
+        for (auto &instr : bb)
         {
-            bool changed = propagateConstants(function, codeOptContext);
-            changed = changed || removeDeadInstructions(function, codeOptContext);
-            if (!changed)
+            Value *pointer = nullptr;
+            bool isLoad = false;
+            if (auto load = dyn_cast<LoadInst>(&instr))
             {
-                break;
+                pointer = load->getPointerOperand();
+                isLoad = true;
             }
-            else
+            else if (auto store = dyn_cast<StoreInst>(&instr))
+            {
+                pointer = store->getPointerOperand();
+            }
+            else if (isa<AllocaInst>(&instr))
+            {
+                // the alloca itself defines an (undefined) value
+                pointer = &instr;
+            }
+            auto alloca = dyn_cast_or_null<AllocaInst>(pointer);
+            auto it = alloca ? allocaIndex.find(alloca) : allocaIndex.end();
+            if (it == allocaIndex.end() || lastSeen[it->second] == &bb)
+            {
+                continue;
+            }
+            lastSeen[it->second] = &bb;
+            if (isLoad)
             {
-                ret = true;
+                exposed[it->second].push_back(&bb);
             }
         }
     }
-    return ret;
-}
\ No newline at end of file
+    return exposed;
+}
+
+// per block flags used while placing the phis of one alloca after the other.
+// A flag counts as set when it holds the stamp of the current alloca, so the flags
+// never have to be cleared and no set is allocated per alloca.
+class BlockFlags
+{
+public:
+    BlockFlags(Function *function)
+    {
+        for (auto &bb : *function)
+        {
+            index[&bb] = index.size();
+        }
+        flags.resize(index.size(), 0);
+    }
+
+    bool isSet(BasicBlock *bb, unsigned stamp) { return flags[index[bb]] == stamp; }
+
+    // returns false if the flag was already set
+    bool set(BasicBlock *bb, unsigned stamp)
+    {
+        auto &flag = flags[index[bb]];
+        if (flag == stamp)
+        {
+            return false;
+        }
+        flag = stamp;
+        return true;
+    }
+
+private:
+    std::unordered_map<BasicBlock *, size_t> index;
+    std::vector<unsigned> flags;
+};
+
+// blocks in which the value of the alloca is live on entry, i.e. some path from
+// the start of the block reaches a load before any store to the alloca.
+// phis are only placed in these blocks (pruned ssa), so we never create dead phis.
+static void computeLiveInBlocks(const std::vector<BasicBlock *> &upwardExposed, BlockFlags &defBlocks,
+                                BlockFlags &liveIn, unsigned stamp)
+{
+    std::vector<BasicBlock *> worklist(upwardExposed.begin(), upwardExposed.end());
+    while (!worklist.empty())
+    {
+        auto bb = worklist.back();
+        worklist.pop_back();
+        if (!liveIn.set(bb, stamp))
+        {
+            continue;
+        }
+        for (auto pred : predecessors(bb))
+        {
+            if (!defBlocks.isSet(pred, stamp))
+            {
+                worklist.push_back(pred);
+            }
+        }
+    }
+}
+
+// Full mem2reg: promotes every promotable alloca of the function to ssa values.
+// The standard Cytron et al. construction is used:
+//   1. a single dominator tree + dominance frontiers for the function
+//   2. phi insertion at the iterated dominance frontier of the stores (pruned by liveness)
+//   3. renaming with a preorder walk over the dominator tree, keeping a stack of
+//      reaching definitions per alloca
+// Overall cost is linear in the size of the function plus the number of inserted phis.
+static bool promoteAllocas(Function *function, CodeOptContext *codeOptContext)
+{
+    std::vector<AllocaInst *> allocas;
+    for (auto &bb : *function)
+    {
+        for (auto &instr : bb)
+        {
+            if (auto alloca = dyn_cast<AllocaInst>(&instr))
+            {
+                if (isPromotable(alloca))
+                {
+                    allocas.push_back(alloca);
+                }
+            }
+        }
+    }
+
+    if (allocas.empty())
+    {
+        return false;
+    }
+
+    DominatorTree DT(*function);
+    auto frontiers = computeDominanceFrontiers(function, DT);
+
+    std::unordered_map<AllocaInst *, unsigned> allocaIndex;
+    for (unsigned i = 0; i < allocas.size(); i++)
+    {
+        allocaIndex[allocas[i]] = i;
+    }
+
+    // phase 1: phi insertion
+    auto upwardExposed = computeUpwardExposedBlocks(function, allocaIndex);
+    BlockFlags defBlocks(function), liveIn(function), hasPhi(function);
+    std::unordered_map<PHINode *, unsigned> phiAlloca;
+    for (unsigned i = 0; i < allocas.size(); i++)
+    {
+        auto alloca = allocas[i];
+        unsigned stamp = i + 1;
+
+        // the alloca itself defines an (undefined) value in its block
+        std::vector<BasicBlock *> worklist = {alloca->getParent()};
+        defBlocks.set(alloca->getParent(), stamp);
+        for (auto user : alloca->users())
+        {
+            if (auto store = dyn_cast<StoreInst>(user))
+            {
+                if (defBlocks.set(store->getParent(), stamp))
+                {
+                    worklist.push_back(store->getParent());
+                }
+            }
+        }
+
+        computeLiveInBlocks(upwardExposed[i], defBlocks, liveIn, stamp);
+
+        while (!worklist.empty())
+        {
+            auto bb = worklist.back();
+            worklist.pop_back();
+            auto frontier = frontiers.find(bb);
+            if (frontier == frontiers.end())
+            {
+                continue;
+            }
+            for (auto join : frontier->second)
+            {
+                if (!liveIn.isSet(join, stamp) || !hasPhi.set(join, stamp))
+                {
+                    continue;
+                }
+                auto phi = PHINode::Create(alloca->getAllocatedType(), pred_size(join),
+                                           alloca->getName() + ".phi", &join->front());
+                phiAlloca[phi] = i;
+                if (!defBlocks.isSet(join, stamp))
+                {
+                    worklist.push_back(join);
+                }
+            }
+        }
+    }
+
+    // phase 2: renaming, iterative preorder walk over the dominator tree
+    std::vector<std::vector<Value *>> reachingDefs(allocas.size());
+    auto currentDef = [&](unsigned idx) -> Value *
+    {
+        if (reachingDefs[idx].empty())
+        {
+            return UndefValue::get(allocas[idx]->getAllocatedType());
+        }
+        return reachingDefs[idx].back();
+    };
+
+    std::vector<Instruction *> toErase;
+    // (dom tree node, allocas whose definition stacks were pushed in that block)
+    std::vector<std::pair<DomTreeNode *, std::vector<unsigned>>> visiting;
+    std::vector<DomTreeNode *> stack = {DT.getRootNode()};
+    while (!stack.empty())
+    {
+        auto node = stack.back();
+        if (!visiting.empty() && visiting.back().first == node)
+        {
+            // all children are done, drop the definitions made in this block
+            for (auto idx : visiting.back().second)
+            {
+                reachingDefs[idx].pop_back();
+            }
+            visiting.pop_back();
+            stack.pop_back();
+            continue;
+        }
+
+        auto bb = node->getBlock();
+        std::vector<unsigned> pushed;
+        for (auto &instr : *bb)
+        {
+            if (auto phi = dyn_cast<PHINode>(&instr))
+            {
+                auto it = phiAlloca.find(phi);
+                if (it != phiAlloca.end())
+                {
+                    reachingDefs[it->second].push_back(phi);
+                    pushed.push_back(it->second);
+                }
+            }
+            else if (auto load = dyn_cast<LoadInst>(&instr))
+            {
+                auto alloca = dyn_cast<AllocaInst>(load->getPointerOperand());
+                auto it = alloca ? allocaIndex.find(alloca) : allocaIndex.end();
+                if (it != allocaIndex.end())
+                {
+                    load->replaceAllUsesWith(currentDef(it->second));
+                    toErase.push_back(load);
+                }
+            }
+            else if (auto store = dyn_cast<StoreInst>(&instr))
+            {
+                auto alloca = dyn_cast<AllocaInst>(store->getPointerOperand());
+                auto it = alloca ? allocaIndex.find(alloca) : allocaIndex.end();
+                if (it != allocaIndex.end())
+                {
+                    reachingDefs[it->second].push_back(store->getValueOperand());
+                    pushed.push_back(it->second);
+                    toErase.push_back(store);
+                }
+            }
+            else if (auto alloca = dyn_cast<AllocaInst>(&instr))
+            {
+                auto it = allocaIndex.find(alloca);
+                if (it != allocaIndex.end())
+                {
+                    reachingDefs[it->second].push_back(UndefValue::get(alloca->getAllocatedType()));
+                    pushed.push_back(it->second);
+                }
+            }
+        }
+
+        // fill in the phi operands of the cfg successors (once per edge)
+        for (auto succ : successors(bb))
+        {
+            for (auto &phi : succ->phis())
+            {
+                auto it = phiAlloca.find(&phi);
+                if (it != phiAlloca.end())
+                {
+                    phi.addIncoming(currentDef(it->second), bb);
+                }
+            }
+        }
+
+        visiting.push_back(std::make_pair(node, std::move(pushed)));
+        for (auto child : node->children())
+        {
+            stack.push_back(child);
+        }
+    }
+
+    // blocks unreachable from entry were not visited, their loads read undef
+    for (auto &bb : *function)
+    {
+        if (DT.isReachableFromEntry(&bb))
+        {
+            continue;
+        }
+        for (auto &instr : bb)
+        {
+            if (auto load = dyn_cast<LoadInst>(&instr))
+            {
+                auto alloca = dyn_cast<AllocaInst>(load->getPointerOperand());
+                if (alloca && allocaIndex.count(alloca))
+                {
+                    load->replaceAllUsesWith(UndefValue::get(load->getType()));
+                    toErase.push_back(load);
+                }
+            }
+            else if (auto store = dyn_cast<StoreInst>(&instr))
+            {
+                auto alloca = dyn_cast<AllocaInst>(store->getPointerOperand());
+                if (alloca && allocaIndex.count(alloca))
+                {
+                    toErase.push_back(store);
+                }
+            }
+        }
+        for (auto succ : successors(&bb))
+        {
+            for (auto &phi : succ->phis())
+            {
+                if (phiAlloca.count(&phi))
+                {
+                    phi.addIncoming(UndefValue::get(phi.getType()), &bb);
+                }
+            }
+        }
+    }
+
+    for (auto instr : toErase)
+    {
+        instr->eraseFromParent();
+    }
+    for (auto alloca : allocas)
+    {
+        alloca->eraseFromParent();
+    }
+    long removed = toErase.size() + allocas.size();
+
+    // fold away phis that merge a single value, e.g. phi [x, a], [x, b] or phi [x, a], [phi, b]
+    std::vector<PHINode *> phiWorklist;
+    for (auto &entry : phiAlloca)
+    {
+        phiWorklist.push_back(entry.first);
+    }
+    std::set<PHINode *> erasedPhis;
+    while (!phiWorklist.empty())
+    {
+        auto phi = phiWorklist.back();
+        phiWorklist.pop_back();
+        if (erasedPhis.count(phi))
+        {
+            continue;
+        }
+        Value *same = nullptr;
+        bool trivial = true;
+        for (auto &incoming : phi->incoming_values())
+        {
+            if (incoming == phi || incoming == same)
+            {
+                continue;
+            }
+            if (same != nullptr)
+            {
+                trivial = false;
+                break;
+            }
+            same = incoming;
+        }
+        if (!trivial)
+        {
+            continue;
+        }
+        if (same == nullptr)
+        {
+            same = UndefValue::get(phi->getType());
+        }
+        for (auto user : phi->users())
+        {
+            if (auto userPhi = dyn_cast<PHINode>(user))
+            {
+                if (userPhi != phi)
+                {
+                    phiWorklist.push_back(userPhi);
+                }
+            }
+        }
+        phi->replaceAllUsesWith(same);
+        phi->eraseFromParent();
+        erasedPhis.insert(phi);
+    }
+
+    currentPass(codeOptContext).removed["promote-allocas"] += removed + erasedPhis.size();
+    currentPass(codeOptContext).added["promote-allocas"] += phiAlloca.size();
+
+    verifyAfterPass(function, codeOptContext, "promote-allocas");
+    return true;
+}
+
+static bool mem2reg(Function *function, CodeOptContext *codeOptContext)
+{
+    bool ret = false;
+    while (true)
+    {
+        currentPass(codeOptContext).iterations++;
+        bool changed = promoteAllocas(function, codeOptContext);
+        changed |= removeDeadStores(function, codeOptContext);
+        changed |= removeDeadInstructions(function, codeOptContext);
+        if (!changed)
+        {
+            break;
+        }
+        else
+        {
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+// lattice value used by the sparse conditional constant propagation below
+struct ConstLattice
+{
+    enum State
+    {
+        UNKNOWN,    // no executable definition seen yet (top)
+        CONSTANT,   // always this constant
+        OVERDEFINED // may take more than one value (bottom)
+    };
+    State state = UNKNOWN;
+    Constant *constant = nullptr;
+};
+
+// Sparse conditional constant propagation (Wegman & Zadeck).
+// Values and cfg edges start optimistic (unknown / not executable) and are lowered
+// with two worklists, one of newly executable blocks and one of instructions whose
+// operands changed. Every instruction is visited a bounded number of times, so
+// a chain of foldable operations is resolved in a single run.
+class ConstantPropagation
+{
+public:
+    ConstantPropagation(Function *function) : function(function) {}
+
+    void solve()
+    {
+        markBlockExecutable(&function->getEntryBlock());
+        do
+        {
+            drainWorklists();
+        } while (resolveUnknownBranches());
+    }
+
+    void drainWorklists()
+    {
+        while (!blockWorklist.empty() || !instrWorklist.empty())
+        {
+            while (!instrWorklist.empty())
+            {
+                auto instr = instrWorklist.back();
+                instrWorklist.pop_back();
+                if (executableBlocks.count(instr->getParent()))
+                {
+                    visit(instr);
+                }
+            }
+            while (!blockWorklist.empty())
+            {
+                auto bb = blockWorklist.back();
+                blockWorklist.pop_back();
+                for (auto &instr : *bb)
+                {
+                    visit(&instr);
+                }
+            }
+        }
+    }
+
+    // a branch whose condition never got a value (e.g. it only depends on itself through phis)
+    // is assumed to go both ways, so that every block we keep has a feasible way out
+    bool resolveUnknownBranches()
+    {
+        bool resolved = false;
+        for (auto bb : executableBlocks)
+        {
+            auto branch = dyn_cast<BranchInst>(bb->getTerminator());
+            if (branch != nullptr && branch->isConditional() &&
+                getValue(branch->getCondition()).state == ConstLattice::UNKNOWN)
+            {
+                resolved |= markEdgeExecutable(bb, branch->getSuccessor(0));
+                resolved |= markEdgeExecutable(bb, branch->getSuccessor(1));
+            }
+        }
+        return resolved;
+    }
+
+    // instructions erased / created by rewrite()
+    long removed = 0;
+    long added = 0;
+
+    // rewrites the function using the solution
+    void rewrite()
+    {
+        for (auto &bb : *function)
+        {
+            if (executableBlocks.count(&bb) == 0)
+            {
+                continue;
+            }
+            for (auto instr = bb.begin(); instr != bb.end();)
+            {
+                auto &val = lattice[&*instr];
+                if (val.state == ConstLattice::CONSTANT && !instr->mayHaveSideEffects() && !instr->isTerminator())
+                {
+                    instr->replaceAllUsesWith(val.constant);
+                    instr = instr->eraseFromParent();
+                    removed++;
+                }
+                else
+                {
+                    instr++;
+                }
+            }
+
+            // a conditional branch with a single feasible successor becomes unconditional
+            auto branch = dyn_cast<BranchInst>(bb.getTerminator());
+            if (branch == nullptr || !branch->isConditional())
+            {
+                continue;
+            }
+            auto trueBB = branch->getSuccessor(0);
+            auto falseBB = branch->getSuccessor(1);
+            bool trueFeasible = executableEdges.count(std::make_pair(&bb, trueBB)) != 0;
+            bool falseFeasible = executableEdges.count(std::make_pair(&bb, falseBB)) != 0;
+            if (trueFeasible && falseFeasible && trueBB != falseBB)
+            {
+                continue;
+            }
+            auto target = trueFeasible ? trueBB : falseBB;
+            auto dead = trueFeasible ? falseBB : trueBB;
+            removed += removePredecessor(dead, &bb);
+            BranchInst::Create(target, branch);
+            auto cond = dyn_cast<Instruction>(branch->getCondition());
+            branch->eraseFromParent();
+            added++;
+            removed++;
+            if (cond != nullptr && cond->use_empty() && !cond->mayHaveSideEffects())
+            {
+                cond->eraseFromParent();
+                removed++;
+            }
+        }
+
+        // blocks that can never execute are deleted
+        std::vector<BasicBlock *> deadBlocks;
+        for (auto &bb : *function)
+        {
+            if (executableBlocks.count(&bb) == 0)
+            {
+                deadBlocks.push_back(&bb);
+            }
+        }
+        for (auto bb : deadBlocks)
+        {
+            for (auto succ : successors(bb))
+            {
+                if (executableBlocks.count(succ))
+                {
+                    removed += removePredecessor(succ, bb);
+                }
+            }
+        }
+        for (auto bb : deadBlocks)
+        {
+            for (auto &instr : *bb)
+            {
+                instr.replaceAllUsesWith(UndefValue::get(instr.getType()));
+                removed++;
+            }
+            bb->dropAllReferences();
+        }
+        for (auto bb : deadBlocks)
+        {
+            bb->eraseFromParent();
+        }
+
+        mergeStraightLineBlocks();
+    }
+
+    // folding branches leaves chains like  a: br b;  b: br c  where b has a as its only
+    // predecessor. Such blocks are merged into their predecessor.
+    void mergeStraightLineBlocks()
+    {
+        for (auto bb = function->begin(); bb != function->end(); bb++)
+        {
+            while (true)
+            {
+                auto branch = dyn_cast<BranchInst>(bb->getTerminator());
+                if (branch == nullptr || branch->isConditional())
+                {
+                    break;
+                }
+                auto succ = branch->getSuccessor(0);
+                if (succ == &*bb || succ->getSinglePredecessor() != &*bb)
+                {
+                    break;
+                }
+                while (auto phi = dyn_cast<PHINode>(&succ->front()))
+                {
+                    phi->replaceAllUsesWith(phi->getIncomingValue(0));
+                    phi->eraseFromParent();
+                    removed++;
+                }
+                // phis of the successors of succ now come from bb (their incoming blocks
+                // aren't uses, replaceAllUsesWith doesn't see them)
+                succ->replaceSuccessorsPhiUsesWith(&*bb);
+                branch->eraseFromParent();
+                removed++;
+                bb->getInstList().splice(bb->end(), succ->getInstList());
+                succ->replaceAllUsesWith(&*bb);
+                succ->eraseFromParent();
+            }
+        }
+    }
+
+private:
+    Function *function;
+    std::unordered_map<Value *, ConstLattice> lattice;
+    std::set<BasicBlock *> executableBlocks;
+    std::set<std::pair<BasicBlock *, BasicBlock *>> executableEdges;
+    std::vector<BasicBlock *> blockWorklist;
+    std::vector<Instruction *> instrWorklist;
+
+    ConstLattice getValue(Value *value)
+    {
+        ConstLattice val;
+        if (auto constant = dyn_cast<Constant>(value))
+        {
+            if (isa<ConstantExpr>(constant) || isa<GlobalValue>(constant))
+            {
+                val.state = ConstLattice::OVERDEFINED;
+            }
+            else
+            {
+                val.state = ConstLattice::CONSTANT;
+                val.constant = constant;
+            }
+            return val;
+        }
+        if (isa<Instruction>(value))
+        {
+            return lattice[value];
+        }
+        // function arguments
+        val.state = ConstLattice::OVERDEFINED;
+        return val;
+    }
+
+    void markBlockExecutable(BasicBlock *bb)
+    {
+        if (executableBlocks.insert(bb).second)
+        {
+            blockWorklist.push_back(bb);
+        }
+    }
+
+    bool markEdgeExecutable(BasicBlock *from, BasicBlock *to)
+    {
+        if (!executableEdges.insert(std::make_pair(from, to)).second)
+        {
+            return false;
+        }
+        if (executableBlocks.count(to) == 0)
+        {
+            markBlockExecutable(to);
+        }
+        else
+        {
+            // a new incoming edge can only change the phis
+            for (auto &phi : to->phis())
+            {
+                instrWorklist.push_back(&phi);
+            }
+        }
+        return true;
+    }
+
+    void update(Instruction *instr, ConstLattice newVal)
+    {
+        auto &val = lattice[instr];
+        if (val.state == ConstLattice::OVERDEFINED || (val.state == newVal.state && val.constant == newVal.constant))
+        {
+            return;
+        }
+        if (val.state == ConstLattice::CONSTANT && newVal.state != ConstLattice::OVERDEFINED)
+        {
+            // values only move down the lattice, a second constant means overdefined
+            newVal.state = ConstLattice::OVERDEFINED;
+        }
+        val = newVal;
+        for (auto user : instr->users())
+        {
+            instrWorklist.push_back(cast<Instruction>(user));
+        }
+    }
+
+    void markOverdefined(Instruction *instr)
+    {
+        ConstLattice val;
+        val.state = ConstLattice::OVERDEFINED;
+        update(instr, val);
+    }
+
+    void markConstant(Instruction *instr, Constant *constant)
+    {
+        ConstLattice val;
+        if (constant == nullptr || isa<ConstantExpr>(constant))
+        {
+            val.state = ConstLattice::OVERDEFINED;
+        }
+        else
+        {
+            val.state = ConstLattice::CONSTANT;
+            val.constant = constant;
+        }
+        update(instr, val);
+    }
+
+    void visit(Instruction *instr)
+    {
+        if (auto phi = dyn_cast<PHINode>(instr))
+        {
+            visitPhi(phi);
+        }
+        else if (auto branch = dyn_cast<BranchInst>(instr))
+        {
+            visitBranch(branch);
+        }
+        else if (instr->isTerminator())
+        {
+            for (auto succ : successors(instr->getParent()))
+            {
+                markEdgeExecutable(instr->getParent(), succ);
+            }
+        }
+        else if (auto select = dyn_cast<SelectInst>(instr))
+        {
+            visitSelect(select);
+        }
+        else if (isa<BinaryOperator>(instr) || isa<CmpInst>(instr) || isa<CastInst>(instr) || isa<UnaryOperator>(instr))
+        {
+            visitFoldable(instr);
+        }
+        else if (!instr->getType()->isVoidTy())
+        {
+            // loads, calls, allocas, ...
+            markOverdefined(instr);
+        }
+    }
+
+    void visitPhi(PHINode *phi)
+    {
+        ConstLattice merged;
+        for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+        {
+            if (executableEdges.count(std::make_pair(phi->getIncomingBlock(i), phi->getParent())) == 0)
+            {
+                continue;
+            }
+            auto val = getValue(phi->getIncomingValue(i));
+            if (val.state == ConstLattice::UNKNOWN)
+            {
+                continue;
+            }
+            if (val.state == ConstLattice::OVERDEFINED ||
+                (merged.state == ConstLattice::CONSTANT && merged.constant != val.constant))
+            {
+                markOverdefined(phi);
+                return;
+            }
+            merged = val;
+        }
+        if (merged.state == ConstLattice::CONSTANT)
+        {
+            markConstant(phi, merged.constant);
+        }
+    }
+
+    void visitBranch(BranchInst *branch)
+    {
+        auto bb = branch->getParent();
+        if (branch->isUnconditional())
+        {
+            markEdgeExecutable(bb, branch->getSuccessor(0));
+            return;
+        }
+        auto cond = getValue(branch->getCondition());
+        if (cond.state == ConstLattice::UNKNOWN)
+        {
+            return;
+        }
+        auto constCond = cond.state == ConstLattice::CONSTANT ? dyn_cast<ConstantInt>(cond.constant) : nullptr;
+        if (constCond == nullptr)
+        {
+            // overdefined or undef: both ways are possible
+            markEdgeExecutable(bb, branch->getSuccessor(0));
+            markEdgeExecutable(bb, branch->getSuccessor(1));
+            return;
+        }
+        markEdgeExecutable(bb, branch->getSuccessor(constCond->isOne() ? 0 : 1));
+    }
+
+    void visitSelect(SelectInst *select)
+    {
+        auto cond = getValue(select->getCondition());
+        if (cond.state == ConstLattice::UNKNOWN)
+        {
+            return;
+        }
+        auto constCond = cond.state == ConstLattice::CONSTANT ? dyn_cast<ConstantInt>(cond.constant) : nullptr;
+        if (constCond != nullptr)
+        {
+            auto chosen = getValue(constCond->isOne() ? select->getTrueValue() : select->getFalseValue());
+            if (chosen.state == ConstLattice::CONSTANT)
+            {
+                markConstant(select, chosen.constant);
+            }
+            else if (chosen.state == ConstLattice::OVERDEFINED)
+            {
+                markOverdefined(select);
+            }
+            return;
+        }
+        // unknown condition, still constant if both arms agree
+        auto trueVal = getValue(select->getTrueValue());
+        auto falseVal = getValue(select->getFalseValue());
+        if (trueVal.state == ConstLattice::CONSTANT && falseVal.state == ConstLattice::CONSTANT &&
+            trueVal.constant == falseVal.constant)
+        {
+            markConstant(select, trueVal.constant);
+        }
+        else if (trueVal.state != ConstLattice::UNKNOWN && falseVal.state != ConstLattice::UNKNOWN)
+        {
+            markOverdefined(select);
+        }
+    }
+
+    void visitFoldable(Instruction *instr)
+    {
+        std::vector<Constant *> operands;
+        for (auto &operand : instr->operands())
+        {
+            auto val = getValue(operand.get());
+            if (val.state == ConstLattice::OVERDEFINED)
+            {
+                markOverdefined(instr);
+                return;
+            }
+            if (val.state == ConstLattice::UNKNOWN)
+            {
+                return;
+            }
+            operands.push_back(val.constant);
+        }
+
+        Constant *result = nullptr;
+        if (auto cmp = dyn_cast<CmpInst>(instr))
+        {
+            result = ConstantExpr::getCompare(cmp->getPredicate(), operands[0], operands[1]);
+        }
+        else if (auto cast = dyn_cast<CastInst>(instr))
+        {
+            result = ConstantExpr::getCast(cast->getOpcode(), operands[0], cast->getType());
+        }
+        else if (isa<UnaryOperator>(instr))
+        {
+            result = ConstantExpr::get(instr->getOpcode(), operands[0]);
+        }
+        else
+        {
+            result = ConstantExpr::get(instr->getOpcode(), operands[0], operands[1]);
+        }
+        markConstant(instr, result);
+    }
+};
+
+// constant propagation + folding over the whole function, including branch folding
+// and removal of the blocks that become unreachable.
+static bool propagateConstants(Function *function, CodeOptContext *codeOptContext)
+{
+    if (function->isDeclaration())
+    {
+        return false;
+    }
+
+    ConstantPropagation propagation(function);
+    propagation.solve();
+    propagation.rewrite();
+
+    currentPass(codeOptContext).removed["constant-folding"] += propagation.removed;
+    currentPass(codeOptContext).added["constant-folding"] += propagation.added;
+
+    verifyAfterPass(function, codeOptContext, "constant-folding");
+    return propagation.removed > 0;
+}
+
+static bool constantFolding(Function *function, CodeOptContext *codeOptContext)
+{
+    bool ret = false;
+    while (true)
+    {
+        currentPass(codeOptContext).iterations++;
+        bool changed = propagateConstants(function, codeOptContext);
+        changed |= removeDeadInstructions(function, codeOptContext);
+        if (!changed)
+        {
+            break;
+        }
+        else
+        {
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+// what makes two instructions compute the same value: opcode, flags (nsw, exact, predicate,
+// ...), type and operands. The operands of commutative instructions are put in a fixed order.
+struct ExpressionKey
+{
+    unsigned opcode = 0;
+    unsigned flags = 0;
+    Type *type = nullptr;
+    Type *sourceType = nullptr;
+    SmallVector<Value *, 3> operands;
+
+    bool operator==(const ExpressionKey &other) const
+    {
+        return opcode == other.opcode && flags == other.flags && type == other.type &&
+               sourceType == other.sourceType && operands == other.operands;
+    }
+};
+
+struct ExpressionKeyHash
+{
+    size_t operator()(const ExpressionKey &key) const
+    {
+        return hash_combine(key.opcode, key.flags, key.type, key.sourceType,
+                            hash_combine_range(key.operands.begin(), key.operands.end()));
+    }
+};
+
+// a value computed earlier on the current dominator tree path, loads are only available
+// as long as memory is still in the same generation
+struct AvailableValue
+{
+    Instruction *instr;
+    unsigned generation;
+};
+
+// the kinds of instructions gvn can replace, also the sub-pass names in -opt-stats
+static const char *expressionKind(Instruction *instr)
+{
+    if (auto load = dyn_cast<LoadInst>(instr))
+    {
+        return load->isSimple() ? "gvn-loads" : nullptr;
+    }
+    if (isa<CmpInst>(instr))
+    {
+        return "gvn-compares";
+    }
+    if (isa<BinaryOperator>(instr) || isa<UnaryOperator>(instr) || isa<CastInst>(instr) ||
+        isa<GetElementPtrInst>(instr) || isa<SelectInst>(instr))
+    {
+        return "gvn-arithmetic";
+    }
+    return nullptr;
+}
+
+static ExpressionKey makeExpressionKey(Instruction *instr)
+{
+    ExpressionKey key;
+    key.opcode = instr->getOpcode();
+    key.flags = instr->getRawSubclassOptionalData();
+    key.type = instr->getType();
+    for (auto &operand : instr->operands())
+    {
+        key.operands.push_back(operand.get());
+    }
+    if (auto cmp = dyn_cast<CmpInst>(instr))
+    {
+        auto predicate = cmp->getPredicate();
+        // a < b and b > a are the same compare
+        if (std::less<Value *>()(key.operands[1], key.operands[0]))
+        {
+            std::swap(key.operands[0], key.operands[1]);
+            predicate = cmp->getSwappedPredicate();
+        }
+        key.flags = (key.flags << 8) | predicate;
+    }
+    else if (instr->isCommutative() && std::less<Value *>()(key.operands[1], key.operands[0]))
+    {
+        std::swap(key.operands[0], key.operands[1]);
+    }
+    else if (auto gep = dyn_cast<GetElementPtrInst>(instr))
+    {
+        key.sourceType = gep->getSourceElementType();
+    }
+    return key;
+}
+
+// Global value numbering over the dominator tree (the "early cse" flavour): a preorder walk
+// keeps a scoped table of the expressions computed in the dominating blocks. An instruction
+// whose opcode, flags, type and operands are already in the table is replaced by the earlier
+// one. Since operands are replaced before their users are looked at, a whole repeated
+// expression tree goes in one walk.
+// Loads are keyed the same way by their address, but every instruction that may write memory
+// (stores, calls) starts a new memory generation and a load is only reused within the
+// generation it was recorded in. A block with several predecessors starts a new generation
+// too, memory may have changed on one of the other paths into it.
+static bool numberValues(Function *function, CodeOptContext *codeOptContext)
+{
+    if (function->isDeclaration())
+    {
+        return false;
+    }
+
+    DominatorTree DT(*function);
+    std::unordered_map<ExpressionKey, std::vector<AvailableValue>, ExpressionKeyHash> available;
+    std::map<std::string, long> removed;
+    unsigned generation = 0;
+
+    // (dom tree node, keys it added to the table), like the renaming walk of promoteAllocas
+    std::vector<std::pair<DomTreeNode *, std::vector<ExpressionKey>>> visiting;
+    // (dom tree node, memory generation at the end of its immediate dominator)
+    std::vector<std::pair<DomTreeNode *, unsigned>> stack = {std::make_pair(DT.getRootNode(), generation)};
+    while (!stack.empty())
+    {
+        auto node = stack.back().first;
+        if (!visiting.empty() && visiting.back().first == node)
+        {
+            // the dominated blocks are done, forget what this block computed
+            for (auto &key : visiting.back().second)
+            {
+                auto it = available.find(key);
+                it->second.pop_back();
+                if (it->second.empty())
+                {
+                    available.erase(it);
+                }
+            }
+            visiting.pop_back();
+            stack.pop_back();
+            continue;
+        }
+
+        auto bb = node->getBlock();
+        generation = bb->getSinglePredecessor() ? stack.back().second : generation + 1;
+        std::vector<ExpressionKey> added;
+        for (auto instr = bb->begin(); instr != bb->end();)
+        {
+            auto kind = expressionKind(&*instr);
+            if (kind == nullptr)
+            {
+                if (instr->mayWriteToMemory())
+                {
+                    generation++;
+                }
+                instr++;
+                continue;
+            }
+
+            auto key = makeExpressionKey(&*instr);
+            auto it = available.find(key);
+            if (it != available.end() &&
+                (!isa<LoadInst>(&*instr) || it->second.back().generation == generation))
+            {
+                instr->replaceAllUsesWith(it->second.back().instr);
+                instr = instr->eraseFromParent();
+                removed[kind]++;
+                continue;
+            }
+            available[key].push_back({&*instr, generation});
+            added.push_back(std::move(key));
+            instr++;
+        }
+
+        unsigned endGeneration = generation;
+        visiting.push_back(std::make_pair(node, std::move(added)));
+        for (auto child : node->children())
+        {
+            stack.push_back(std::make_pair(child, endGeneration));
+        }
+    }
+
+    long total = 0;
+    for (auto &entry : removed)
+    {
+        currentPass(codeOptContext).removed[entry.first] += entry.second;
+        total += entry.second;
+    }
+
+    verifyAfterPass(function, codeOptContext, "gvn");
+    return total > 0;
+}
+
+static bool gvn(Function *function, CodeOptContext *codeOptContext)
+{
+    currentPass(codeOptContext).iterations++;
+    return numberValues(function, codeOptContext);
+}
+
+// A natural loop: a header that dominates a latch branching back to it, plus every block
+// that reaches a latch without going through the header. Back edges to the same header
+// make up a single loop.
+struct NaturalLoop
+{
+    BasicBlock *header = nullptr;
+    // the single block outside the loop that branches to the header, nullptr if there is none
+    // (ensurePreheaders() creates one for every loop)
+    BasicBlock *preheader = nullptr;
+    std::vector<BasicBlock *> latches;
+    // the blocks of this loop that are not in a nested loop, in dominator tree preorder:
+    // the header comes first and a block always comes after its dominators
+    std::vector<BasicBlock *> blocks;
+    NaturalLoop *parent = nullptr;
+    std::vector<NaturalLoop *> subLoops;
+    // the loops are numbered depth first, this loop contains the loops numbered first..last
+    unsigned first = 0;
+    unsigned last = 0;
+};
+
+// All loops of a function, found the way LLVM's LoopInfo does it: the headers are visited
+// in dominator tree postorder, so inner loops are found before the loops around them, and
+// the backward walk from the latches jumps over a nested loop straight to its header.
+// Every block is visited once per loop it is the innermost block of, so the analysis stays
+// linear however deep the loops are nested.
+struct LoopForest
+{
+    // innermost loops first
+    std::vector<std::unique_ptr<NaturalLoop>> loops;
+    // innermost loop of every block in a loop
+    std::unordered_map<BasicBlock *, NaturalLoop *> loopOf;
+
+    LoopForest(Function *function, DominatorTree &DT)
+    {
+        for (auto node : post_order(DT.getRootNode()))
+        {
+            auto header = node->getBlock();
+            std::vector<BasicBlock *> latches;
+            for (auto pred : predecessors(header))
+            {
+                if (DT.isReachableFromEntry(pred) && DT.dominates(header, pred) &&
+                    std::find(latches.begin(), latches.end(), pred) == latches.end())
+                {
+                    latches.push_back(pred);
+                }
+            }
+            if (!latches.empty())
+            {
+                discoverLoop(header, latches, DT);
+            }
+        }
+
+        unsigned number = 0;
+        for (auto &loop : loops)
+        {
+            if (loop->parent == nullptr)
+            {
+                numberLoops(loop.get(), number);
+            }
+        }
+        for (auto node : depth_first(DT.getRootNode()))
+        {
+            if (auto loop = innermost(node->getBlock()))
+            {
+                loop->blocks.push_back(node->getBlock());
+            }
+        }
+        for (auto &loop : loops)
+        {
+            findPreheader(loop.get());
+        }
+    }
+
+    NaturalLoop *innermost(BasicBlock *bb) const
+    {
+        auto it = loopOf.find(bb);
+        return it == loopOf.end() ? nullptr : it->second;
+    }
+
+    bool contains(NaturalLoop *loop, BasicBlock *bb) const
+    {
+        auto inner = innermost(bb);
+        return inner != nullptr && inner->first >= loop->first && inner->first <= loop->last;
+    }
+
+private:
+    void discoverLoop(BasicBlock *header, const std::vector<BasicBlock *> &latches, DominatorTree &DT)
+    {
+        loops.push_back(std::make_unique<NaturalLoop>());
+        auto loop = loops.back().get();
+        loop->header = header;
+        loop->latches = latches;
+        loopOf[header] = loop;
+
+        std::vector<BasicBlock *> worklist(latches.begin(), latches.end());
+        while (!worklist.empty())
+        {
+            auto bb = worklist.back();
+            worklist.pop_back();
+            auto inner = innermost(bb);
+            if (inner == nullptr)
+            {
+                loopOf[bb] = loop;
+                for (auto pred : predecessors(bb))
+                {
+                    if (DT.isReachableFromEntry(pred))
+                    {
+                        worklist.push_back(pred);
+                    }
+                }
+                continue;
+            }
+            while (inner->parent != nullptr)
+            {
+                inner = inner->parent;
+            }
+            if (inner == loop)
+            {
+                continue;
+            }
+            // a nested loop found earlier, continue at the edges that enter it
+            inner->parent = loop;
+            loop->subLoops.push_back(inner);
+            for (auto pred : predecessors(inner->header))
+            {
+                if (DT.isReachableFromEntry(pred) && !DT.dominates(inner->header, pred))
+                {
+                    worklist.push_back(pred);
+                }
+            }
+        }
+    }
+
+    void numberLoops(NaturalLoop *loop, unsigned &number)
+    {
+        loop->first = number++;
+        for (auto subLoop : loop->subLoops)
+        {
+            numberLoops(subLoop, number);
+        }
+        loop->last = number - 1;
+    }
+
+    void findPreheader(NaturalLoop *loop)
+    {
+        BasicBlock *outside = nullptr;
+        for (auto pred : predecessors(loop->header))
+        {
+            if (contains(loop, pred))
+            {
+                continue;
+            }
+            if (outside != nullptr && outside != pred)
+            {
+                return;
+            }
+            outside = pred;
+        }
+        if (outside != nullptr && outside->getSingleSuccessor() == loop->header)
+        {
+            loop->preheader = outside;
+        }
+    }
+};
+
+// Gives every loop a preheader: a new block that all the edges entering the header from
+// outside the loop go through, so code can be hoisted to a place that runs once before
+// the loop. Header phis get the incoming values of those edges merged in the preheader.
+// Returns the number of preheaders created, the caller has to recompute the dominator tree
+// and the loops (the new blocks belong to the loops around).
+static long ensurePreheaders(Function *function, LoopForest &nest, CodeOptContext *codeOptContext)
+{
+    long created = 0;
+    for (auto &loop : nest.loops)
+    {
+        if (loop->preheader != nullptr)
+        {
+            continue;
+        }
+        auto header = loop->header;
+        std::vector<BasicBlock *> outside;
+        for (auto pred : predecessors(header))
+        {
+            if (!nest.contains(loop.get(), pred) && std::find(outside.begin(), outside.end(), pred) == outside.end())
+            {
+                outside.push_back(pred);
+            }
+        }
+        if (outside.empty())
+        {
+            // only reachable through the back edges
+            continue;
+        }
+
+        auto preheader = BasicBlock::Create(function->getContext(), header->getName() + ".preheader",
+                                            function, header);
+        BranchInst::Create(header, preheader);
+        currentPass(codeOptContext).added["preheaders"]++;
+        for (auto &phi : header->phis())
+        {
+            auto merged = PHINode::Create(phi.getType(), outside.size(), phi.getName() + ".ph",
+                                          preheader->getTerminator());
+            for (int i = phi.getNumIncomingValues() - 1; i >= 0; i--)
+            {
+                if (!nest.contains(loop.get(), phi.getIncomingBlock(i)))
+                {
+                    merged->addIncoming(phi.getIncomingValue(i), phi.getIncomingBlock(i));
+                    phi.removeIncomingValue(i, false);
+                }
+            }
+            phi.addIncoming(merged, preheader);
+            currentPass(codeOptContext).added["preheaders"]++;
+        }
+        for (auto pred : outside)
+        {
+            pred->getTerminator()->replaceSuccessorWith(header, preheader);
+        }
+        for (auto phi = preheader->begin(); isa<PHINode>(&*phi);)
+        {
+            // every edge brought the same value, no merge needed
+            if (auto same = cast<PHINode>(&*phi)->hasConstantValue())
+            {
+                phi->replaceAllUsesWith(same);
+                phi = phi->eraseFromParent();
+                currentPass(codeOptContext).added["preheaders"]--;
+                continue;
+            }
+            phi++;
+        }
+
+        loop->preheader = preheader;
+        created++;
+    }
+    return created;
+}
+
+// the loops of the function, after giving each of them a preheader. `changed` is set
+// if preheaders had to be created (DT is kept up to date).
+static std::unique_ptr<LoopForest> analyzeLoops(Function *function, DominatorTree &DT,
+                                                CodeOptContext *codeOptContext, bool &changed)
+{
+    auto forest = std::make_unique<LoopForest>(function, DT);
+    long preheaders = forest->loops.empty() ? 0 : ensurePreheaders(function, *forest, codeOptContext);
+    if (preheaders > 0)
+    {
+        currentPass(codeOptContext).events["preheaders created"] += preheaders;
+        DT.recalculate(*function);
+        forest = std::make_unique<LoopForest>(function, DT);
+        changed = true;
+    }
+    return forest;
+}
+
+// globals a loop may write to. Stores into allocas can't change a global, every other
+// store or any call that may write memory can change all of them (`everything`).
+struct LoopWrites
+{
+    bool everything = false;
+    std::unordered_set<Value *> globals;
+};
+
+// the writes in the blocks of the loop that are not in a nested loop
+static void collectLoopWrites(NaturalLoop *loop, LoopWrites &writes)
+{
+    for (auto bb : loop->blocks)
+    {
+        for (auto &instr : *bb)
+        {
+            if (!instr.mayWriteToMemory())
+            {
+                continue;
+            }
+            auto store = dyn_cast<StoreInst>(&instr);
+            auto object = store && store->isSimple() ? getUnderlyingObject(store->getPointerOperand()) : nullptr;
+            if (object != nullptr && isa<GlobalVariable>(object))
+            {
+                writes.globals.insert(object);
+            }
+            else if (object == nullptr || !isa<AllocaInst>(object))
+            {
+                writes.everything = true;
+                return;
+            }
+        }
+    }
+}
+
+// true if moving the instruction out of the loop gives the same result: it only depends on
+// values defined outside the loop, can't trap (divisions need a safe constant divisor) and
+// either doesn't touch memory or loads a global the loop never writes.
+static bool isLoopInvariant(Instruction *instr, NaturalLoop *loop, const LoopForest &nest, const LoopWrites &writes)
+{
+    if (isa<PHINode>(instr) || isa<AllocaInst>(instr) || instr->isTerminator())
+    {
+        return false;
+    }
+    for (auto &operand : instr->operands())
+    {
+        auto operandInstr = dyn_cast<Instruction>(operand.get());
+        if (operandInstr != nullptr && nest.contains(loop, operandInstr->getParent()))
+        {
+            return false;
+        }
+    }
+    if (auto load = dyn_cast<LoadInst>(instr))
+    {
+        auto global = dyn_cast<GlobalVariable>(load->getPointerOperand());
+        return load->isSimple() && global != nullptr && !writes.everything && writes.globals.count(global) == 0;
+    }
+    return !instr->mayReadOrWriteMemory() && isSafeToSpeculativelyExecute(instr);
+}
+
+// Loop invariant code motion: hoists the invariant instructions of every loop into its
+// preheader, innermost loops first. The preheader of an inner loop belongs to the loop
+// around it, so invariant code leaves a whole loop nest one level at a time. A loop only
+// looks at its own blocks: what stayed in a nested loop depends on that loop and can't be
+// invariant in the outer one either.
+static bool hoistLoopInvariants(Function *function, CodeOptContext *codeOptContext)
+{
+    if (function->isDeclaration())
+    {
+        return false;
+    }
+
+    DominatorTree DT(*function);
+    bool changed = false;
+    auto nest = analyzeLoops(function, DT, codeOptContext, changed);
+    if (nest->loops.empty())
+    {
+        return false;
+    }
+    currentPass(codeOptContext).events["loops"] += nest->loops.size();
+
+    // an instruction moves out one loop at a time, count it once
+    std::unordered_set<Instruction *> hoisted;
+    std::unordered_map<NaturalLoop *, LoopWrites> writesOf;
+    for (auto &loop : nest->loops)
+    {
+        auto &writes = writesOf[loop.get()];
+        collectLoopWrites(loop.get(), writes);
+        for (auto subLoop : loop->subLoops)
+        {
+            auto &subWrites = writesOf[subLoop];
+            writes.everything |= subWrites.everything;
+            writes.globals.insert(subWrites.globals.begin(), subWrites.globals.end());
+        }
+        if (loop->preheader == nullptr)
+        {
+            continue;
+        }
+
+        auto insertPoint = loop->preheader->getTerminator();
+        for (auto bb : loop->blocks)
+        {
+            for (auto instr = bb->begin(); instr != bb->end();)
+            {
+                auto current = &*instr++;
+                if (isLoopInvariant(current, loop.get(), *nest, writes))
+                {
+                    current->moveBefore(insertPoint);
+                    hoisted.insert(current);
+                }
+            }
+        }
+    }
+    currentPass(codeOptContext).events["instructions hoisted"] += hoisted.size();
+
+    verifyAfterPass(function, codeOptContext, "licm");
+    return !hoisted.empty() || changed;
+}
+
+static bool licm(Function *function, CodeOptContext *codeOptContext)
+{
+    currentPass(codeOptContext).iterations++;
+    return hoistLoopInvariants(function, codeOptContext);
+}
+
+// A basic induction variable: a header phi that starts at `init` (from the preheader) and
+// goes up by the loop invariant `step` on every trip around the loop.
+struct InductionVariable
+{
+    PHINode *phi;
+    Value *init;
+    Value *step;
+};
+
+// the test at the top of a while loop, rewritten so the loop goes on while
+// `icmp predicate iv, limit` holds (iv on the left, inverted if the true edge leaves the loop)
+struct ExitTest
+{
+    BranchInst *branch = nullptr;
+    InductionVariable *iv = nullptr;
+    Value *limit = nullptr;
+    CmpInst::Predicate predicate = CmpInst::BAD_ICMP_PREDICATE;
+    // the true edge of the branch goes on with the loop
+    bool trueStays = true;
+};
+
+static bool isInvariantIn(Value *value, NaturalLoop *loop, const LoopForest &forest)
+{
+    auto instr = dyn_cast<Instruction>(value);
+    return instr == nullptr || !forest.contains(loop, instr->getParent());
+}
+
+// the basic induction variables of a loop with a preheader and a single latch
+static std::vector<InductionVariable> findInductionVariables(NaturalLoop *loop, const LoopForest &forest)
+{
+    std::vector<InductionVariable> ivs;
+    if (loop->preheader == nullptr || loop->latches.size() != 1)
+    {
+        return ivs;
+    }
+    for (auto &phi : loop->header->phis())
+    {
+        if (!phi.getType()->isIntegerTy() || phi.getNumIncomingValues() != 2)
+        {
+            continue;
+        }
+        auto next = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(loop->latches[0]));
+        if (next == nullptr)
+        {
+            continue;
+        }
+        Value *step = nullptr;
+        if (next->getOpcode() == Instruction::Add)
+        {
+            step = next->getOperand(0) == &phi ? next->getOperand(1) : next->getOperand(0);
+            if (next->getOperand(0) != &phi && next->getOperand(1) != &phi)
+            {
+                step = nullptr;
+            }
+        }
+        else if (next->getOpcode() == Instruction::Sub && next->getOperand(0) == &phi)
+        {
+            if (auto constant = dyn_cast<ConstantInt>(next->getOperand(1)))
+            {
+                step = ConstantInt::get(constant->getType(), -constant->getValue());
+            }
+        }
+        if (step != nullptr && step != &phi && isInvariantIn(step, loop, forest))
+        {
+            ivs.push_back({&phi, phi.getIncomingValueForBlock(loop->preheader), step});
+        }
+    }
+    return ivs;
+}
+
+static bool findExitTest(NaturalLoop *loop, const LoopForest &forest, std::vector<InductionVariable> &ivs,
+                         ExitTest &test)
+{
+    auto branch = dyn_cast<BranchInst>(loop->header->getTerminator());
+    if (branch == nullptr || !branch->isConditional())
+    {
+        return false;
+    }
+    bool trueStays = forest.contains(loop, branch->getSuccessor(0));
+    if (trueStays == forest.contains(loop, branch->getSuccessor(1)))
+    {
+        return false;
+    }
+    auto cmp = dyn_cast<ICmpInst>(branch->getCondition());
+    if (cmp == nullptr)
+    {
+        return false;
+    }
+    for (auto &iv : ivs)
+    {
+        auto predicate = cmp->getPredicate();
+        Value *limit = nullptr;
+        if (cmp->getOperand(0) == iv.phi)
+        {
+            limit = cmp->getOperand(1);
+        }
+        else if (cmp->getOperand(1) == iv.phi)
+        {
+            limit = cmp->getOperand(0);
+            predicate = CmpInst::getSwappedPredicate(predicate);
+        }
+        if (limit == nullptr || !isInvariantIn(limit, loop, forest))
+        {
+            continue;
+        }
+        test.branch = branch;
+        test.iv = &iv;
+        test.limit = limit;
+        test.predicate = trueStays ? predicate : CmpInst::getInversePredicate(predicate);
+        test.trueStays = trueStays;
+        return true;
+    }
+    return false;
+}
+
+// Number of times the body of the loop runs and the value of the iv when the loop is left,
+// when start, step and limit are all constants. The ordered tests are computed in twice the
+// width of the iv, so nothing overflows on the way, and return false if the loop never ends
+// or the iv would wrap around before it does (then the test isn't the plain count it looks
+// like). != is counted modulo the width of the iv.
+static bool computeConstantTripCount(const ExitTest &test, APInt &tripCount, APInt &exitValue)
+{
+    auto init = dyn_cast<ConstantInt>(test.iv->init);
+    auto step = dyn_cast<ConstantInt>(test.iv->step);
+    auto limit = dyn_cast<ConstantInt>(test.limit);
+    if (init == nullptr || step == nullptr || limit == nullptr || step->isZero())
+    {
+        return false;
+    }
+    unsigned bits = init->getBitWidth();
+    unsigned wide = bits * 2 + 2;
+    bool isSigned = ICmpInst::isSigned(test.predicate);
+    APInt start = isSigned ? init->getValue().sext(wide) : init->getValue().zext(wide);
+    APInt end = isSigned ? limit->getValue().sext(wide) : limit->getValue().zext(wide);
+    APInt delta = step->getValue().sext(wide);
+
+    // as `start + k * delta < end` when counting up, `> end` when counting down
+    switch (test.predicate)
+    {
+    case ICmpInst::ICMP_SLE:
+    case ICmpInst::ICMP_ULE:
+        end += 1;
+        LLVM_FALLTHROUGH;
+    case ICmpInst::ICMP_SLT:
+    case ICmpInst::ICMP_ULT:
+        if (!delta.isStrictlyPositive())
+        {
+            return false;
+        }
+        break;
+    case ICmpInst::ICMP_SGE:
+    case ICmpInst::ICMP_UGE:
+        end -= 1;
+        LLVM_FALLTHROUGH;
+    case ICmpInst::ICMP_SGT:
+    case ICmpInst::ICMP_UGT:
+        if (!delta.isNegative())
+        {
+            return false;
+        }
+        break;
+    case ICmpInst::ICMP_NE:
+    {
+        // != has no signedness, the iv wraps around like the add does: the distance to the
+        // limit is taken modulo 2^bits in the direction of the step, and the iv has to land
+        // on the limit exactly on the way (so i = -5; i != 3; i++ runs 8 times)
+        bool down = step->isNegative();
+        APInt distance = down ? init->getValue() - limit->getValue() : limit->getValue() - init->getValue();
+        APInt magnitude = down ? -step->getValue() : step->getValue();
+        if (distance.urem(magnitude) != 0)
+        {
+            return false;
+        }
+        tripCount = distance.udiv(magnitude).zext(wide);
+        exitValue = limit->getValue();
+        return true;
+    }
+    default:
+        return false;
+    }
+
+    APInt count(wide, 0);
+    if (delta.isStrictlyPositive() && start.slt(end))
+    {
+        count = (end - start + delta - 1).sdiv(delta);
+    }
+    else if (delta.isNegative() && start.sgt(end))
+    {
+        count = (start - end - delta - 1).sdiv(-delta);
+    }
+    APInt last = start + count * delta;
+    if (isSigned ? !last.isSignedIntN(bits) : last.isNegative() || !last.isIntN(bits))
+    {
+        return false;
+    }
+    tripCount = count;
+    exitValue = last.trunc(bits);
+    return true;
+}
+
+// true if a branch on the way into the loop already checked the exit test against the start
+// value, e.g. the `if (n <= 0) return` in front of `while (n > 0)`
+static bool isTestedOnEntry(NaturalLoop *loop, const ExitTest &test)
+{
+    auto bb = loop->preheader;
+    for (int depth = 0; depth < 8; depth++)
+    {
+        auto pred = bb->getSinglePredecessor();
+        auto branch = pred ? dyn_cast<BranchInst>(pred->getTerminator()) : nullptr;
+        if (branch == nullptr)
+        {
+            return false;
+        }
+        auto cmp = branch->isConditional() ? dyn_cast<ICmpInst>(branch->getCondition()) : nullptr;
+        if (cmp != nullptr && branch->getSuccessor(0) != branch->getSuccessor(1))
+        {
+            auto predicate = branch->getSuccessor(0) == bb ? cmp->getPredicate() : cmp->getInversePredicate();
+            if (cmp->getOperand(0) == test.iv->init && cmp->getOperand(1) == test.limit &&
+                predicate == test.predicate)
+            {
+                return true;
+            }
+            if (cmp->getOperand(1) == test.iv->init && cmp->getOperand(0) == test.limit &&
+                CmpInst::getSwappedPredicate(predicate) == test.predicate)
+            {
+                return true;
+            }
+        }
+        bb = pred;
+    }
+    return false;
+}
+
+// The value the iv has when the loop is left, if the exit test can be written as
+// `iv != exit value`: known for constant loops, and for steps of +1/-1 when the loop runs
+// at least once (then the iv stops right at the limit of a strict < or >).
+static Value *findExitValue(NaturalLoop *loop, const ExitTest &test)
+{
+    APInt tripCount, exitValue;
+    if (computeConstantTripCount(test, tripCount, exitValue))
+    {
+        return ConstantInt::get(test.iv->phi->getType(), exitValue);
+    }
+    auto step = dyn_cast<ConstantInt>(test.iv->step);
+    if (step == nullptr || !(step->isOne() || step->isMinusOne()) || !isTestedOnEntry(loop, test))
+    {
+        return nullptr;
+    }
+    // for <= and >= the iv stops one past a constant limit
+    auto limit = dyn_cast<ConstantInt>(test.limit);
+    switch (test.predicate)
+    {
+    case ICmpInst::ICMP_SLT:
+    case ICmpInst::ICMP_ULT:
+        return step->isOne() ? test.limit : nullptr;
+    case ICmpInst::ICMP_SGT:
+    case ICmpInst::ICMP_UGT:
+        return step->isMinusOne() ? test.limit : nullptr;
+    case ICmpInst::ICMP_SLE:
+    case ICmpInst::ICMP_ULE:
+        if (!step->isOne() || limit == nullptr || limit->isMaxValue(test.predicate == ICmpInst::ICMP_SLE))
+        {
+            return nullptr;
+        }
+        return ConstantInt::get(limit->getType(), limit->getValue() + 1);
+    case ICmpInst::ICMP_SGE:
+    case ICmpInst::ICMP_UGE:
+        if (!step->isMinusOne() || limit == nullptr || limit->isMinValue(test.predicate == ICmpInst::ICMP_SGE))
+        {
+            return nullptr;
+        }
+        return ConstantInt::get(limit->getType(), limit->getValue() - 1);
+    default:
+        return nullptr;
+    }
+}
+
+// rewrites the exit test of the loop to `iv != exit value` (an equality test on the basic iv,
+// which later passes like unrolling can read the trip count from)
+static bool canonicalizeExitTest(NaturalLoop *loop, const ExitTest &test, CodeOptContext *codeOptContext)
+{
+    auto exitValue = findExitValue(loop, test);
+    if (exitValue == nullptr)
+    {
+        return false;
+    }
+    auto branch = test.branch;
+    auto oldCmp = cast<ICmpInst>(branch->getCondition());
+    auto predicate = test.trueStays ? ICmpInst::ICMP_NE : ICmpInst::ICMP_EQ;
+    if (oldCmp->getPredicate() == predicate && oldCmp->getOperand(0) == test.iv->phi &&
+        oldCmp->getOperand(1) == exitValue)
+    {
+        return false;
+    }
+    auto cmp = new ICmpInst(branch, predicate, test.iv->phi, exitValue, oldCmp->getName());
+    branch->setCondition(cmp);
+    currentPass(codeOptContext).added["exit-tests"]++;
+    if (oldCmp->use_empty())
+    {
+        oldCmp->eraseFromParent();
+        currentPass(codeOptContext).removed["exit-tests"]++;
+    }
+    return true;
+}
+
+// value = scale * iv + offset, with scale and offset invariant in the loop of the iv
+struct AffineValue
+{
+    InductionVariable *iv;
+    Value *scale;
+    Value *offset;
+};
+
+static bool isConstantInt(Value *value, int64_t expected)
+{
+    auto constant = dyn_cast<ConstantInt>(value);
+    return constant != nullptr && constant->getSExtValue() == expected;
+}
+
+// a + b and a * b for the parts of affine values, without the instructions for + 0 and * 1
+static Value *addInvariants(IRBuilder<> &builder, Value *a, Value *b)
+{
+    return isConstantInt(a, 0) ? b : isConstantInt(b, 0) ? a : builder.CreateAdd(a, b);
+}
+
+static Value *multiplyInvariants(IRBuilder<> &builder, Value *a, Value *b)
+{
+    if (isConstantInt(a, 0) || isConstantInt(b, 0))
+    {
+        return ConstantInt::get(a->getType(), 0);
+    }
+    return isConstantInt(a, 1) ? b : isConstantInt(b, 1) ? a : builder.CreateMul(a, b);
+}
+
+// Finds the derived induction variables of the loop (values that are an affine function of
+// a basic one, like i * stride + base) and replaces every multiplication among them by a new
+// header phi that is stepped by an addition: m = s * i + o becomes m' = s * init + o before
+// the loop and m' += s * step on every trip. The invariant parts are computed in the
+// preheader, the parts nobody needs in the end are deleted as dead code.
+static long reduceStrength(NaturalLoop *loop, const LoopForest &forest, std::vector<InductionVariable> &ivs,
+                           CodeOptContext *codeOptContext)
+{
+    IRBuilder<> builder(loop->preheader->getTerminator());
+    std::unordered_map<Value *, AffineValue> affine;
+    std::vector<Value *> worklist;
+    for (auto &iv : ivs)
+    {
+        auto type = iv.phi->getType();
+        affine[iv.phi] = {&iv, ConstantInt::get(type, 1), ConstantInt::get(type, 0)};
+        worklist.push_back(iv.phi);
+    }
+
+    // follow the uses of the ivs, every value found is affine in one of them
+    std::vector<BinaryOperator *> multiplies;
+    while (!worklist.empty())
+    {
+        auto value = worklist.back();
+        worklist.pop_back();
+        auto known = affine[value];
+        for (auto user : value->users())
+        {
+            auto instr = dyn_cast<BinaryOperator>(user);
+            if (instr == nullptr || affine.count(instr) || instr->getType() != value->getType() ||
+                !forest.contains(loop, instr->getParent()) || instr->getOperand(0) == instr->getOperand(1))
+            {
+                continue;
+            }
+            bool isLeft = instr->getOperand(0) == value;
+            auto other = instr->getOperand(isLeft ? 1 : 0);
+            if (!isInvariantIn(other, loop, forest))
+            {
+                continue;
+            }
+            AffineValue derived = known;
+            switch (instr->getOpcode())
+            {
+            case Instruction::Add:
+                derived.offset = addInvariants(builder, known.offset, other);
+                break;
+            case Instruction::Sub:
+                if (isLeft)
+                {
+                    derived.offset = builder.CreateSub(known.offset, other);
+                }
+                else
+                {
+                    derived.scale = builder.CreateNeg(known.scale);
+                    derived.offset = builder.CreateSub(other, known.offset);
+                }
+                break;
+            case Instruction::Mul:
+                derived.scale = multiplyInvariants(builder, known.scale, other);
+                derived.offset = multiplyInvariants(builder, known.offset, other);
+                multiplies.push_back(instr);
+                break;
+            case Instruction::Shl:
+                if (!isLeft || !isa<ConstantInt>(other))
+                {
+                    continue;
+                }
+                derived.scale = builder.CreateShl(known.scale, other);
+                derived.offset = builder.CreateShl(known.offset, other);
+                break;
+            default:
+                continue;
+            }
+            affine[instr] = derived;
+            worklist.push_back(instr);
+        }
+    }
+    currentPass(codeOptContext).events["derived induction variables"] += affine.size() - ivs.size();
+
+    // the most derived multiplies go first, so i * s in (i * s + b) * 4 is dead by the time it is reached
+    long reduced = 0;
+    std::unordered_set<Instruction *> deleted;
+    auto latch = loop->latches[0];
+    for (auto it = multiplies.rbegin(); it != multiplies.rend(); it++)
+    {
+        auto multiply = *it;
+        if (deleted.count(multiply))
+        {
+            continue;
+        }
+        // after the loop the new phi is a step ahead of the value the multiply had last
+        bool usedOutside = false;
+        for (auto user : multiply->users())
+        {
+            usedOutside |= !forest.contains(loop, cast<Instruction>(user)->getParent());
+        }
+        if (usedOutside)
+        {
+            continue;
+        }
+        auto &derived = affine[multiply];
+        auto iv = derived.iv;
+        auto start = addInvariants(builder, multiplyInvariants(builder, derived.scale, iv->init), derived.offset);
+        auto step = multiplyInvariants(builder, derived.scale, iv->step);
+        auto phi = PHINode::Create(multiply->getType(), 2, multiply->getName() + ".sr", &loop->header->front());
+        auto next = BinaryOperator::CreateAdd(phi, step, multiply->getName() + ".sr.next", latch->getTerminator());
+        phi->addIncoming(start, loop->preheader);
+        phi->addIncoming(next, latch);
+        multiply->replaceAllUsesWith(phi);
+        reduced++;
+
+        // drop the chain that computed the multiply, the ivs stay alive through their latch update
+        std::vector<Instruction *> dead = {multiply};
+        while (!dead.empty())
+        {
+            auto instr = dead.back();
+            dead.pop_back();
+            if (!instr->use_empty() || !deleted.insert(instr).second)
+            {
+                continue;
+            }
+            for (auto &operand : instr->operands())
+            {
+                auto operandInstr = dyn_cast<Instruction>(operand.get());
+                if (operandInstr != nullptr && !isa<PHINode>(operandInstr) && affine.count(operandInstr))
+                {
+                    dead.push_back(operandInstr);
+                }
+            }
+            instr->dropAllReferences();
+        }
+    }
+    for (auto instr : deleted)
+    {
+        instr->eraseFromParent();
+    }
+    currentPass(codeOptContext).removed["strength-reduction"] += deleted.size();
+    currentPass(codeOptContext).added["strength-reduction"] += reduced * 2;
+    return reduced;
+}
+
+// Induction variable simplification: for every loop (innermost first) finds the basic
+// induction variables, canonicalizes the exit test and strength reduces the multiplications
+// of induction variables to additions.
+static bool simplifyInductionVariables(Function *function, CodeOptContext *codeOptContext)
+{
+    if (function->isDeclaration())
+    {
+        return false;
+    }
+
+    DominatorTree DT(*function);
+    bool changed = false;
+    auto forest = analyzeLoops(function, DT, codeOptContext, changed);
+    for (auto &loop : forest->loops)
+    {
+        auto ivs = findInductionVariables(loop.get(), *forest);
+        if (ivs.empty())
+        {
+            continue;
+        }
+        currentPass(codeOptContext).events["induction variables"] += ivs.size();
+
+        ExitTest test;
+        if (findExitTest(loop.get(), *forest, ivs, test) && canonicalizeExitTest(loop.get(), test, codeOptContext))
+        {
+            currentPass(codeOptContext).events["exit tests canonicalized"]++;
+            changed = true;
+        }
+        if (reduceStrength(loop.get(), *forest, ivs, codeOptContext) > 0)
+        {
+            changed = true;
+        }
+    }
+    verifyAfterPass(function, codeOptContext, "indvars");
+    // the old multiplies' operands and unused invariant parts
+    removeDeadInstructions(function, codeOptContext);
+    return changed;
+}
+
+static bool indvars(Function *function, CodeOptContext *codeOptContext)
+{
+    currentPass(codeOptContext).iterations++;
+    return simplifyInductionVariables(function, codeOptContext);
+}
+
+// The successors of the header inside and outside the loop, if the exit test in the header
+// is the only way out of the loop (no return in the body) and the loop is more than its header.
+static bool findHeaderExit(NaturalLoop *loop, const LoopForest &forest, const ExitTest &test, BasicBlock *&body,
+                           BasicBlock *&exit)
+{
+    body = test.branch->getSuccessor(test.trueStays ? 0 : 1);
+    exit = test.branch->getSuccessor(test.trueStays ? 1 : 0);
+    if (body == loop->header || loop->latches[0] == loop->header)
+    {
+        return false;
+    }
+    for (auto bb : loop->blocks)
+    {
+        if (bb == loop->header)
+        {
+            continue;
+        }
+        for (auto succ : successors(bb))
+        {
+            if (!forest.contains(loop, succ))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// size of one trip around the loop, in instructions that survive copying (phis don't)
+static long countLoopInstructions(NaturalLoop *loop)
+{
+    long size = 0;
+    for (auto bb : loop->blocks)
+    {
+        size += bb->size() - std::distance(bb->phis().begin(), bb->phis().end());
+    }
+    return size;
+}
+
+// Copies one trip around the loop in front of the header. The header phis are replaced by the
+// values in `current`, which are then advanced to the values for the next trip. The copied header
+// goes straight on into the copied body (the caller knows the exit test holds), or to `exit` when
+// only the header is copied for the final test. The copied latch still branches to the original
+// header, the caller links it to whatever comes next. Instructions that have constant operands
+// after the copy are folded right away. Returns the copy of the header.
+static BasicBlock *cloneIteration(NaturalLoop *loop, BasicBlock *body, BasicBlock *exit, std::vector<Value *> &current,
+                                  const std::string &suffix, ValueToValueMapTy &VMap,
+                                  std::vector<BasicBlock *> &newBlocks, CodeOptContext *codeOptContext)
+{
+    auto header = loop->header;
+    auto latch = loop->latches[0];
+    auto function = header->getParent();
+    bool headerOnly = body == nullptr;
+
+    SmallVector<BasicBlock *, 8> clones;
+    for (auto bb : loop->blocks)
+    {
+        if (headerOnly && bb != header)
+        {
+            continue;
+        }
+        auto clone = CloneBasicBlock(bb, VMap, suffix, function);
+        clone->moveBefore(header);
+        VMap[bb] = clone;
+        clones.push_back(clone);
+        newBlocks.push_back(clone);
+    }
+    unsigned i = 0;
+    for (auto &phi : header->phis())
+    {
+        cast<PHINode>(VMap[&phi])->eraseFromParent();
+        VMap[&phi] = current[i++];
+    }
+    remapInstructionsInBlocks(clones, VMap);
+
+    auto headerClone = cast<BasicBlock>(VMap[header]);
+    headerClone->getTerminator()->eraseFromParent();
+    BranchInst::Create(headerOnly ? exit : cast<BasicBlock>(VMap[body]), headerClone);
+    if (!headerOnly)
+    {
+        cast<BasicBlock>(VMap[latch])->getTerminator()->replaceSuccessorWith(headerClone, header);
+    }
+
+    auto &dataLayout = function->getParent()->getDataLayout();
+    for (auto clone : clones)
+    {
+        for (auto instr = clone->begin(); instr != clone->end();)
+        {
+            if (auto folded = ConstantFoldInstruction(&*instr, dataLayout))
+            {
+                instr->replaceAllUsesWith(folded);
+                instr = instr->eraseFromParent();
+                continue;
+            }
+            currentPass(codeOptContext).added["unroll"]++;
+            instr++;
+        }
+    }
+
+    if (!headerOnly)
+    {
+        // the map follows the folding above, so these are the values after it
+        i = 0;
+        for (auto &phi : header->phis())
+        {
+            auto next = phi.getIncomingValueForBlock(latch);
+            Value *mapped = VMap.lookup(next);
+            current[i++] = mapped ? mapped : next;
+        }
+    }
+    return headerClone;
+}
+
+// Replaces a loop that runs a known number of times by that many copies of its body, followed
+// by a copy of the header for the final test. Code after the loop gets the values of that test.
+static void unrollFully(NaturalLoop *loop, const LoopForest &forest, BasicBlock *body, BasicBlock *exit,
+                        uint64_t tripCount, std::vector<BasicBlock *> &newBlocks, CodeOptContext *codeOptContext)
+{
+    auto header = loop->header;
+    std::vector<Value *> current;
+    for (auto &phi : header->phis())
+    {
+        current.push_back(phi.getIncomingValueForBlock(loop->preheader));
+    }
+
+    BasicBlock *previous = loop->preheader;
+    BasicBlock *finalTest = nullptr;
+    ValueToValueMapTy VMap;
+    for (uint64_t trip = 0; trip <= tripCount; trip++)
+    {
+        VMap.clear();
+        bool last = trip == tripCount;
+        auto headerClone = cloneIteration(loop, last ? nullptr : body, exit, current,
+                                          ".unroll" + std::to_string(trip), VMap, newBlocks, codeOptContext);
+        previous->getTerminator()->replaceSuccessorWith(header, headerClone);
+        if (last)
+        {
+            finalTest = headerClone;
+        }
+        else
+        {
+            previous = cast<BasicBlock>(VMap[loop->latches[0]]);
+        }
+    }
+
+    // only the header's values can be used after the loop, the body doesn't dominate the exit
+    for (auto &instr : *header)
+    {
+        Value *mapped = VMap.lookup(&instr);
+        if (mapped == nullptr)
+        {
+            continue;
+        }
+        instr.replaceUsesWithIf(mapped, [&](Use &use)
+                                { return !forest.contains(loop, cast<Instruction>(use.getUser())->getParent()); });
+    }
+    exit->replacePhiUsesWith(header, finalTest);
+
+    for (auto bb : loop->blocks)
+    {
+        currentPass(codeOptContext).removed["unroll"] += bb->size();
+        bb->dropAllReferences();
+    }
+    for (auto bb : loop->blocks)
+    {
+        bb->eraseFromParent();
+    }
+}
+
+// Runtime unrolling: puts a copy of the loop with `factor` trips per round in front of it. The
+// copy only goes around while at least `factor` trips are left, so it needs no exit test of its
+// own; the original loop runs the remaining trips. This needs the number of trips left at the
+// top of the header, so only loops stepping the iv by one towards a != or strict limit are done.
+static bool unrollPartially(NaturalLoop *loop, const ExitTest &test, BasicBlock *body, unsigned factor,
+                            std::vector<BasicBlock *> &newBlocks, CodeOptContext *codeOptContext)
+{
+    auto step = dyn_cast<ConstantInt>(test.iv->step);
+    if (step == nullptr || !(step->isOne() || step->isMinusOne()) ||
+        !isUIntN(test.iv->phi->getType()->getIntegerBitWidth(), factor))
+    {
+        return false;
+    }
+    bool up = step->isOne();
+    switch (test.predicate)
+    {
+    case ICmpInst::ICMP_NE:
+        break;
+    case ICmpInst::ICMP_SLT:
+    case ICmpInst::ICMP_ULT:
+        if (!up)
+        {
+            return false;
+        }
+        break;
+    case ICmpInst::ICMP_SGT:
+    case ICmpInst::ICMP_UGT:
+        if (up)
+        {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    auto header = loop->header;
+    auto preheader = loop->preheader;
+    auto function = header->getParent();
+    auto check = BasicBlock::Create(function->getContext(), header->getName() + ".unrolled", function, header);
+    newBlocks.push_back(check);
+    std::vector<PHINode *> phis;
+    std::vector<Value *> current;
+    Value *iv = nullptr;
+    for (auto &phi : header->phis())
+    {
+        auto index = phi.getBasicBlockIndex(preheader);
+        auto merged = PHINode::Create(phi.getType(), 2, phi.getName() + ".unrolled", check);
+        merged->addIncoming(phi.getIncomingValue(index), preheader);
+        phi.setIncomingValue(index, merged);
+        phi.setIncomingBlock(index, check);
+        phis.push_back(merged);
+        current.push_back(merged);
+        if (&phi == test.iv->phi)
+        {
+            iv = merged;
+        }
+        currentPass(codeOptContext).added["unroll"]++;
+    }
+    preheader->getTerminator()->replaceSuccessorWith(header, check);
+
+    // trips left = distance to the limit, which is exact for != and, once the test holds, for < and >
+    IRBuilder<> builder(check);
+    Value *left = iv;
+    if (up)
+    {
+        left = builder.CreateSub(test.limit, iv);
+    }
+    else if (!isConstantInt(test.limit, 0))
+    {
+        left = builder.CreateSub(iv, test.limit);
+    }
+    auto enough = builder.CreateICmpUGE(left, ConstantInt::get(iv->getType(), factor));
+    if (test.predicate != ICmpInst::ICMP_NE)
+    {
+        enough = builder.CreateAnd(builder.CreateICmp(test.predicate, iv, test.limit), enough);
+    }
+
+    BasicBlock *previous = check;
+    ValueToValueMapTy VMap;
+    for (unsigned trip = 0; trip < factor; trip++)
+    {
+        VMap.clear();
+        auto headerClone = cloneIteration(loop, body, nullptr, current, ".unroll" + std::to_string(trip), VMap,
+                                          newBlocks, codeOptContext);
+        if (trip == 0)
+        {
+            builder.CreateCondBr(enough, headerClone, header);
+        }
+        else
+        {
+            previous->getTerminator()->replaceSuccessorWith(header, headerClone);
+        }
+        previous = cast<BasicBlock>(VMap[loop->latches[0]]);
+    }
+    previous->getTerminator()->replaceSuccessorWith(header, check);
+    for (unsigned i = 0; i < phis.size(); i++)
+    {
+        phis[i]->addIncoming(current[i], previous);
+    }
+    currentPass(codeOptContext).added["unroll"] += check->size() - phis.size();
+    return true;
+}
+
+// Loop unrolling of innermost loops with an induction variable exit test (see indvars).
+// A loop with a constant trip count is unrolled completely if all the copies together stay
+// within -unroll-threshold instructions, any other loop that fits -unroll-count times in the
+// threshold gets a runtime unrolled copy with the original loop as the remainder loop.
+// The chains of blocks the copies leave behind are merged at the end.
+static bool unrollLoops(Function *function, CodeOptContext *codeOptContext)
+{
+    if (function->isDeclaration() || codeOptContext->unrollThreshold == 0)
+    {
+        return false;
+    }
+
+    DominatorTree DT(*function);
+    bool changed = false;
+    auto forest = analyzeLoops(function, DT, codeOptContext, changed);
+    long threshold = codeOptContext->unrollThreshold;
+    std::vector<BasicBlock *> newBlocks;
+    for (auto &loop : forest->loops)
+    {
+        if (!loop->subLoops.empty())
+        {
+            continue;
+        }
+        auto ivs = findInductionVariables(loop.get(), *forest);
+        ExitTest test;
+        BasicBlock *body = nullptr;
+        BasicBlock *exit = nullptr;
+        if (ivs.empty() || !findExitTest(loop.get(), *forest, ivs, test) ||
+            !findHeaderExit(loop.get(), *forest, test, body, exit))
+        {
+            continue;
+        }
+
+        long size = countLoopInstructions(loop.get());
+        APInt tripCount, exitValue;
+        if (computeConstantTripCount(test, tripCount, exitValue) && tripCount.ult(threshold) &&
+            (long)tripCount.getZExtValue() * size <= threshold)
+        {
+            unrollFully(loop.get(), *forest, body, exit, tripCount.getZExtValue(), newBlocks, codeOptContext);
+            currentPass(codeOptContext).events["loops fully unrolled"]++;
+            currentPass(codeOptContext).events["iterations unrolled"] += tripCount.getZExtValue();
+            changed = true;
+        }
+        else if (codeOptContext->unrollCount > 1 && size * codeOptContext->unrollCount <= threshold &&
+                 unrollPartially(loop.get(), test, body, codeOptContext->unrollCount, newBlocks, codeOptContext))
+        {
+            currentPass(codeOptContext).events["loops partially unrolled"]++;
+            currentPass(codeOptContext).events["iterations unrolled"] += codeOptContext->unrollCount;
+            changed = true;
+        }
+    }
+
+    std::unordered_set<BasicBlock *> copied(newBlocks.begin(), newBlocks.end());
+    for (auto bb = function->begin(); bb != function->end();)
+    {
+        auto block = &*bb++;
+        if (copied.count(block) && MergeBlockIntoPredecessor(block))
+        {
+            copied.erase(block);
+        }
+    }
+    verifyAfterPass(function, codeOptContext, "unroll");
+    // the exit tests of the copied headers
+    removeDeadInstructions(function, codeOptContext);
+    return changed;
+}
+
+static bool unroll(Function *function, CodeOptContext *codeOptContext)
+{
+    currentPass(codeOptContext).iterations++;
+    return unrollLoops(function, codeOptContext);
+}
+
+// whether the call graph walk below may inline `callee` into a function of component `caller`
+static bool shouldInline(Function *callee, size_t caller, const std::unordered_map<Function *, size_t> &componentOf,
+                         const std::vector<bool> &recursive, CodeOptContext *codeOptContext)
+{
+    if (callee == nullptr || callee->isDeclaration() || callee->isVarArg())
+    {
+        return false;
+    }
+    auto component = componentOf.at(callee);
+    if (component == caller || recursive[component])
+    {
+        currentPass(codeOptContext).events["recursive calls kept"]++;
+        return false;
+    }
+    if (callee->hasFnAttribute(Attribute::InlineHint))
+    {
+        return true;
+    }
+    return callee->getInstructionCount() <= codeOptContext->inlineThreshold;
+}
+
+// Inliner over the call graph of the module. The strongly connected components of the call
+// graph are visited bottom-up (callees first), so by the time a function is looked at as a
+// callee its own calls are inlined already and it has been cleaned up, and its size is the
+// size it adds to the caller. Calls to functions marked `inline` are always inlined, others
+// only if the callee has at most -inline-threshold instructions. Calls within a recursive
+// cycle (or to a function that calls itself) are kept. Every function something got inlined
+// into runs through mem2reg and constfold again, which fold the arguments into the copy.
+static bool inlineFunctions(CodeOptContext *codeOptContext)
+{
+    auto module = codeOptContext->module.get();
+    std::vector<std::vector<Function *>> components;
+    std::vector<bool> recursive;
+    std::unordered_map<Function *, size_t> componentOf;
+    {
+        CallGraph callGraph(*module);
+        for (auto scc = scc_begin(&callGraph); !scc.isAtEnd(); ++scc)
+        {
+            std::vector<Function *> functions;
+            for (auto node : *scc)
+            {
+                if (auto function = node->getFunction())
+                {
+                    componentOf[function] = components.size();
+                    functions.push_back(function);
+                }
+            }
+            recursive.push_back(scc.hasCycle());
+            components.push_back(std::move(functions));
+        }
+    }
+
+    bool changed = false;
+    for (size_t component = 0; component < components.size(); component++)
+    {
+        for (auto caller : components[component])
+        {
+            if (caller->isDeclaration())
+            {
+                continue;
+            }
+            std::vector<CallInst *> calls;
+            for (auto &bb : *caller)
+            {
+                for (auto &instr : bb)
+                {
+                    auto call = dyn_cast<CallInst>(&instr);
+                    if (call != nullptr &&
+                        shouldInline(call->getCalledFunction(), component, componentOf, recursive, codeOptContext))
+                    {
+                        calls.push_back(call);
+                    }
+                }
+            }
+
+            long inlined = 0;
+            for (auto call : calls)
+            {
+                auto callee = call->getCalledFunction();
+                long size = callee->getInstructionCount();
+                bool hinted = callee->hasFnAttribute(Attribute::InlineHint);
+                InlineFunctionInfo info;
+                // no lifetime markers, mem2reg only promotes allocas that are just loaded and stored
+                if (!InlineFunction(*call, info, nullptr, false).isSuccess())
+                {
+                    continue;
+                }
+                currentPass(codeOptContext).removed["inline"]++;
+                currentPass(codeOptContext).added["inline"] += size;
+                currentPass(codeOptContext).events[hinted ? "calls inlined (marked inline)" : "calls inlined"]++;
+                inlined++;
+            }
+            if (inlined == 0)
+            {
+                continue;
+            }
+            verifyAfterPass(caller, codeOptContext, "inline");
+            mem2reg(caller, codeOptContext);
+            constantFolding(caller, codeOptContext);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Runs the new PassManager's per-module default pipeline directly on the module,
+// instead of printing it and re-parsing it in a separate `opt` process.
+static bool runLLVMPipeline(CodeOptContext *codeOptContext, OptimizationLevel level)
+{
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB(codeOptContext->targetMachine);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(level);
+    MPM.run(*codeOptContext->module, MAM);
+    return true;
+}
+
+static bool llvmO1(CodeOptContext *codeOptContext)
+{
+    return runLLVMPipeline(codeOptContext, OptimizationLevel::O1);
+}
+
+static bool llvmO2(CodeOptContext *codeOptContext)
+{
+    return runLLVMPipeline(codeOptContext, OptimizationLevel::O2);
+}
+
+static bool llvmO3(CodeOptContext *codeOptContext)
+{
+    return runLLVMPipeline(codeOptContext, OptimizationLevel::O3);
+}
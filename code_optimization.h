@@ -11,19 +11,56 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/Target/TargetMachine.h>
 #include <vector>
 #include <iostream>
 #include <unordered_map>
+#include <map>
 #include <set>
+#include <string>
 #include <memory>
 
 using namespace llvm;
 
+// what one pass of the pipeline did, filled in by optimize()
+struct PassStats
+{
+    std::string name;
+    // with several optimizer threads, the time of a function pass is summed over the threads
+    double wallSeconds = 0;
+    long instructionsBefore = 0;
+    long instructionsAfter = 0;
+    // fixed-point iterations of the pass, summed over all functions
+    long iterations = 0;
+    // sub-pass name -> number of instructions it erased / created
+    std::map<std::string, long> removed;
+    std::map<std::string, long> added;
+    // other things the pass counts, e.g. loops found or instructions hoisted
+    std::map<std::string, long> events;
+};
+
 struct CodeOptContext
 {
     std::unique_ptr<LLVMContext> context;
     std::unique_ptr<Module> module;
     std::unique_ptr<IRBuilder<>> builder;
+    // passes run by optimize(), in order
+    std::vector<std::string> pipeline = {"mem2reg", "constfold", "inline", "gvn", "licm", "indvars", "unroll"};
+    std::vector<PassStats> passStats;
+    // entry of passStats the running pass records into
+    size_t activePass = 0;
+    // function passes run on this many threads (-opt-threads), 1 runs them in place
+    unsigned threads = 1;
+    // run verifyFunction after every sub-pass (slow, for debugging the optimizer)
+    bool verifyEach = false;
+    // size (in instructions) loops may grow to by unrolling (-unroll-threshold), 0 turns it off
+    unsigned unrollThreshold = 150;
+    // copies of the body per round when a loop is unrolled partially (-unroll-count)
+    unsigned unrollCount = 4;
+    // callees of up to this many instructions are inlined (-inline-threshold), `inline` ones always
+    unsigned inlineThreshold = 40;
+    // target the module is compiled for, lets the llvm-O* pipelines use target info (optional)
+    TargetMachine *targetMachine = nullptr;
     CodeOptContext(LLVMContext *context,
                    Module *module,
                    IRBuilder<> *builder)
@@ -31,4 +68,14 @@ struct CodeOptContext
           module(std::move(module)), builder(std::move(builder)) {}
 };
 
-void optimize(CodeOptContext *codeOptContext);
\ No newline at end of file
+// number of instructions in all functions of the module
+long countInstructions(Module *module);
+
+// runs codeOptContext->pipeline over the module, recording a PassStats entry per pass
+void optimize(CodeOptContext *codeOptContext);
+
+// parses a comma separated list of pass names as given to -passes=
+// returns false (with a message in `error`) if a pass doesn't exist
+bool parsePipeline(const std::string &spec, std::vector<std::string> &pipeline, std::string &error);
+
+void printOptStats(CodeOptContext *codeOptContext, std::ostream &out, bool json = false);
\ No newline at end of file
@@ -0,0 +1,9 @@
+int main() {
+    int i;
+    int s;
+    i = 0;
+    s = 0;
+    while (i < 0) i = i + 1;
+    while (s < 3) s = s + 1;
+    return s;
+}
@@ -0,0 +1,15 @@
+int loop3(int n)
+{
+	int s;
+	s = 0;
+	while (n < 3) {
+		s = s + n;
+		n = n+1;
+	}
+	return s;
+}
+
+int main()
+{
+  return loop3(7) + loop3(-5) + loop3(2) + 20;
+}
@@ -0,0 +1,30 @@
+int up()
+{
+	int i;
+	int t;
+	i = -5;
+	t = 0;
+	while (i < 3) {
+		t = t + i*i;
+		i = i+1;
+	}
+	return t;
+}
+
+int down()
+{
+	int i;
+	int t;
+	i = 4;
+	t = 0;
+	while (i > -4) {
+		t = t*2 + i;
+		i = i-2;
+	}
+	return t;
+}
+
+int main()
+{
+  return up() + down();
+}
@@ -0,0 +1,41 @@
+int count(int n)
+{
+	int s;
+	s = 0;
+	while (n < 10) {
+		s = s + n;
+		n = n+1;
+	}
+	return s;
+}
+
+int squares()
+{
+	int i;
+	int s;
+	i = 0;
+	s = 0;
+	while (i < 6) {
+		s = s + i*i;
+		i = i+1;
+	}
+	return s;
+}
+
+int down()
+{
+	int i;
+	int t;
+	i = 9;
+	t = 0;
+	while (i > -3) {
+		t = t + i;
+		i = i-3;
+	}
+	return t;
+}
+
+int main()
+{
+  return count(4) + count(1000) + squares() + down();
+}
@@ -0,0 +1,58 @@
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+// Per-thread deques of work items (indices, e.g. of functions). A thread takes from the
+// back of its own deque and, once that is empty, steals from the front of the others,
+// so one big item doesn't leave the other threads idle.
+class WorkStealingQueues
+{
+public:
+    WorkStealingQueues(size_t items, unsigned threads) : queues(threads)
+    {
+        // contiguous ranges, so a thread mostly gets neighbouring items
+        for (size_t i = 0; i < items; i++)
+        {
+            queues[i * threads / items].items.push_back(i);
+        }
+    }
+
+    // false once every deque is empty
+    bool pop(unsigned thread, size_t &item)
+    {
+        for (unsigned i = 0; i < queues.size(); i++)
+        {
+            auto &queue = queues[(thread + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.items.empty())
+            {
+                continue;
+            }
+            if (i == 0)
+            {
+                item = queue.items.back();
+                queue.items.pop_back();
+            }
+            else
+            {
+                item = queue.items.front();
+                queue.items.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<size_t> items;
+    };
+    std::vector<Queue> queues;
+};
+
+#endif